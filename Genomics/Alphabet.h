@@ -0,0 +1,71 @@
+#ifndef ALPHABET_INCLUDED
+#define ALPHABET_INCLUDED
+
+  // Key alphabets for Trie.  CharAlphabet is the open alphabet, where any char
+  // can label a node.  A fixed alphabet maps each of its SIZE symbols to a code
+  // in [0, SIZE), which lets a Trie specialized on it index children directly
+  // instead of searching for them.
+
+struct CharAlphabet
+{
+    static const int SIZE = 0;      // no fixed size
+};
+
+struct AlphabetTables
+{
+    signed char code[256];          // -1 for chars outside the alphabet
+    char symbol[8];
+    char complement[256];           // '\0' for chars outside the alphabet
+};
+
+constexpr AlphabetTables makeDNA5Tables()
+{
+    AlphabetTables t{};
+    for(int i = 0; i < 256; i++){
+        t.code[i] = -1;
+        t.complement[i] = '\0';
+    }
+    const char upper[] = "ACGTN";
+    const char lower[] = "acgtn";
+    const char paired[] = "TGCAN";
+    for(int i = 0; i < 5; i++){
+        t.symbol[i] = upper[i];
+        t.code[(unsigned char)upper[i]] = i;
+        t.code[(unsigned char)lower[i]] = i;
+        t.complement[(unsigned char)upper[i]] = paired[i];
+        t.complement[(unsigned char)lower[i]] = paired[i];
+    }
+    return t;
+}
+
+  // the tables live in a class template so the header can define them
+template<typename Unused = void>
+struct DNA5Tables
+{
+    static constexpr AlphabetTables tables = makeDNA5Tables();
+};
+
+template<typename Unused>
+constexpr AlphabetTables DNA5Tables<Unused>::tables;
+
+  // A, C, G, T and N, coded 0 to 4, so the four real bases fit in two bits.
+  // Lowercase bases are accepted and decode to uppercase.
+struct DNA5
+{
+    static const int SIZE = 5;
+
+    static constexpr int encode(char c)
+    {
+        return DNA5Tables<>::tables.code[(unsigned char)c];
+    }
+    static constexpr char decode(int code)
+    {
+        return DNA5Tables<>::tables.symbol[code];
+    }
+    static constexpr char complement(char c)
+    {
+        return DNA5Tables<>::tables.complement[(unsigned char)c];
+    }
+};
+
+#endif // ALPHABET_INCLUDED
@@ -0,0 +1,71 @@
+#ifndef COUNTINGALLOCATOR_INCLUDED
+#define COUNTINGALLOCATOR_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+  // A running total of the bytes currently allocated through the
+  // CountingAllocators that point at it.
+class MemoryCounter
+{
+public:
+    MemoryCounter() : m_bytes(0) {}
+    void add(size_t numBytes) { m_bytes += numBytes; }
+    void remove(size_t numBytes) { m_bytes -= numBytes; }
+    size_t bytes() const { return m_bytes; }
+
+    MemoryCounter(const MemoryCounter&) = delete;
+    MemoryCounter& operator=(const MemoryCounter&) = delete;
+private:
+    std::atomic<size_t> m_bytes;
+};
+
+  // std::allocator, except that it also tallies what it hands out in a
+  // MemoryCounter.  A null counter counts nothing.  The counter travels with
+  // a container when it is moved or swapped, so the bytes stay charged to the
+  // component that first allocated them.
+template<typename T>
+class CountingAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    CountingAllocator(MemoryCounter* counter = nullptr) : m_counter(counter) {}
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : m_counter(other.counter()) {}
+
+    T* allocate(size_t n)
+    {
+        T* p = std::allocator<T>().allocate(n);
+        if(m_counter != nullptr)
+            m_counter->add(n * sizeof(T));
+        return p;
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if(m_counter != nullptr)
+            m_counter->remove(n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+    MemoryCounter* counter() const { return m_counter; }
+private:
+    MemoryCounter* m_counter;
+};
+
+template<typename T, typename U>
+bool operator==(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{
+    return a.counter() == b.counter();
+}
+
+template<typename T, typename U>
+bool operator!=(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{
+    return a.counter() != b.counter();
+}
+
+#endif // COUNTINGALLOCATOR_INCLUDED
@@ -1,4 +1,6 @@
 #include "provided.h"
+#include "GzipStream.h"
+#include "Alphabet.h"
 #include <string>
 #include <vector>
 #include <iostream>
@@ -10,13 +12,13 @@ class GenomeImpl
 public:
     GenomeImpl(const string& nm, const string& sequence);
     static bool load(istream& genomeSource, vector<Genome>& genomes);
-    int length() const;
+    long long length() const;
     string name() const;
-    bool extract(int position, int length, string& fragment) const;
+    bool extract(long long position, long long length, string& fragment) const;
 private:
     string m_name;
     string m_genome;
-    int m_length;
+    long long m_length;
 };
 
 GenomeImpl::GenomeImpl(const string& nm, const string& sequence)
@@ -28,6 +30,12 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
     if(!genomeSource)
         return false;
     
+    // compressed input is inflated as it is parsed, so it never touches disk uncompressed
+    if(isGzipStream(genomeSource)){
+        GzipIstream inflated(genomeSource);
+        return load(inflated, genomes) && !inflated.corrupt();
+    }
+    
     genomes.clear();
     string temp, tempName, tempGenome;
     getline(genomeSource, temp);
@@ -52,30 +60,10 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
                 tempGenome = "";
                 break;
             }
-            switch(temp[i]){
-                case 'g':
-                case 'G':
-                    tempGenome += 'G';
-                    break;
-                case 'a':
-                case 'A':
-                    tempGenome += 'A';
-                    break;
-                case 'c':
-                case 'C':
-                    tempGenome += 'C';
-                    break;
-                case 't':
-                case 'T':
-                    tempGenome += 'T';
-                    break;
-                case 'n':
-                case 'N':
-                    tempGenome += 'N';
-                    break;
-                default:
-                    return false;
-            }
+            int code = DNA5::encode(temp[i]);
+            if(code < 0)
+                return false;
+            tempGenome += DNA5::decode(code);
         }
     }
     if(tempGenome != ""){          // if there are genome lines after the last name line, add it to the vector
@@ -86,7 +74,7 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
     return false;                   // if there are no genome lines, return false
 }
 
-int GenomeImpl::length() const
+long long GenomeImpl::length() const
 {
     return m_length;
 }
@@ -96,9 +84,10 @@ string GenomeImpl::name() const
     return m_name;
 }
 
-bool GenomeImpl::extract(int position, int length, string& fragment) const
+bool GenomeImpl::extract(long long position, long long length, string& fragment) const
 {
-    if(position + length > m_length){
+    // compare without adding, so a huge position or length can't overflow
+    if(position < 0 || length < 0 || position > m_length || length > m_length - position){
         return false;
     }
     fragment = m_genome.substr(position, length);
@@ -138,7 +127,7 @@ bool Genome::load(istream& genomeSource, vector<Genome>& genomes)
     return GenomeImpl::load(genomeSource, genomes);
 }
 
-int Genome::length() const
+long long Genome::length() const
 {
     return m_impl->length();
 }
@@ -148,7 +137,7 @@ string Genome::name() const
     return m_impl->name();
 }
 
-bool Genome::extract(int position, int length, string& fragment) const
+bool Genome::extract(long long position, long long length, string& fragment) const
 {
     return m_impl->extract(position, length, fragment);
 }
@@ -8,77 +8,963 @@
 #include <fstream>
 #include <utility>
 #include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstring>
 
 #include "Trie.h"
+#include "Posting.h"
 using namespace std;
 
-bool comparePairByGenome(pair<int, int> p1, pair<int, int> p2){
-    if(p1.first == p2.first){           // if the genome is the same, order by the position in the genome
-        return p1.second < p2.second;
+const int SKETCH_K = 21;                // long enough that shared k-mers mean shared sequence
+const uint64_t SKETCH_SCALE = 64;       // keep roughly one in SKETCH_SCALE k-mer hashes
+const long long SKETCH_CHUNK = 1 << 20; // bases read at a time while sketching
+
+const int APPROX_MIN_SAMPLE = 64;       // fragments to check before trusting any interval
+const int APPROX_BATCH = 32;            // fragments to check between stopping tests
+const double APPROX_Z = 1.96;           // 95% confidence
+
+const int CHAIN_MIN_SEEDS = 2;          // seed-and-chain once minimumLength covers this many k-mers
+
+const int SLIDING_PRUNE_INTERVAL = 4096;        // windows between cleanups of sliding-window state
+const size_t SLIDING_MAX_CACHED_SEEDS = 65536;
+
+const int BUILD_PREFIX_LENGTH = 3;      // rebuilding splits k-mers into 5^3 parts by their first bases
+const long long BUILD_CHUNK = 1 << 20;  // k-mers read at a time while rebuilding
+
+static uint64_t mixHash(uint64_t x){     // murmur3's 64-bit finalizer
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// builds a FracMinHash sketch: the hashes of every k-mer whose hash falls in the
+// bottom 1/SKETCH_SCALE of the hash range, sorted and without duplicates.
+// k-mers containing N are skipped.  the genome is read a chunk at a time, so
+// a long one is never copied whole.
+static void sketchGenome(const Genome& genome, int k, vector<uint64_t>& sketch){
+    sketch.clear();
+    const uint64_t maxHash = UINT64_MAX / SKETCH_SCALE;
+    const uint64_t mask = ((uint64_t)1 << (2*k)) - 1;
+    uint64_t kmer = 0;
+    int valid = 0;                      // number of trailing bases that weren't N
+    string bases;
+    for(long long start = 0; start < genome.length(); start += SKETCH_CHUNK){
+        genome.extract(start, min(SKETCH_CHUNK, genome.length() - start), bases);
+        for(size_t i = 0; i < bases.length(); i++){
+            int code = DNA5::encode(bases[i]);
+            if(code < 0 || code > 3){       // N (or anything else) isn't one of the two-bit bases
+                valid = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | code) & mask;
+            if(++valid >= k){
+                uint64_t h = mixHash(kmer);
+                if(h < maxHash)
+                    sketch.push_back(h);
+            }
+        }
     }
+    sort(sketch.begin(), sketch.end());
+    sketch.erase(unique(sketch.begin(), sketch.end()), sketch.end());
+}
+
+// the most one posting of a genome can add to a frozen list.  the first in a
+// group pays for the genome id delta, the count, the first position and the
+// width (the count and width are a byte each, spread over the group); the
+// rest pay for a gap, which is no wider than a position.
+static size_t maxFrozenPostingBytes(int genome, long long length){
+    return varintBytes(genome) + varintBytes(length) + 2;
+}
+
+// the frozen index's trie only says which k-mers have a posting list.  every
+// key is k bases long, so the lists are made in the trie's breadth-first key
+// order, and a key's rank among the frozen keys is its list id.
+struct HasList {};
+typedef Trie<HasList, DNA5> FrozenTrie;
+
+// a k-mer index over the whole library.  the matcher always has one for its
+// minimum search length and may keep more for longer k-mers.
+class KmerIndex
+{
+public:
+    KmerIndex(int k, MemoryCounter* indexMemory, MemoryCounter* frozenMemory)
+    :m_k(k), m_indexMemory(indexMemory), m_frozenMemory(frozenMemory),
+     m_dna(indexMemory), m_postings(frozenMemory), m_numFrozenGenomes(0),
+     m_recentPostingBytes(0), m_recentFrozenNodes(0), m_recentLists(0) {}
+    int k() const { return m_k; }
+    int numFrozenGenomes() const { return m_numFrozenGenomes; }
+    void add(const Genome& genome, int id);
+    bool build(const vector<Genome>& genomes, size_t maxBytes);
+    void freeze(int numGenomes);
+    vector<Posting> lookup(const string& kmer, bool exactMatchOnly, const vector<char>* candidates = nullptr) const;
+    size_t addCost(const Genome& genome, int id, size_t& freezeCostAfter) const;
+    size_t freezeCost() const { return freezeCost(0, 0, 0); }
+private:
+    int m_k;
+    MemoryCounter* m_indexMemory;
+    MemoryCounter* m_frozenMemory;
     
-    return p1.first < p2.first;         // order by position of genomes in vector
+    // the Trie maps strings to Postings       (position of genome in vector, position within genome)
+    // once the index has been frozen, it only holds genomes added since then
+    Trie<Posting, DNA5> m_dna;
+    
+    // the frozen index: each k-mer maps to one compressed list in m_postings
+    unique_ptr<FrozenTrie> m_frozenDna;
+    PostingLists m_postings;
+    int m_numFrozenGenomes;                 // genomes 0 to this-1 are in the frozen index
+    // what m_dna will add to the frozen index: at most this many bytes of
+    // postings, and exactly this many nodes and lists
+    size_t m_recentPostingBytes;
+    size_t m_recentFrozenNodes;
+    size_t m_recentLists;
+    
+    size_t freezeCost(double newNodes, double newLists, size_t newPostingBytes) const;
+    size_t buildCost(const vector<long long>& partSizes, int prefixLength, unsigned int numThreads, const vector<Genome>& genomes) const;
+};
+
+// the trie never stores a k-mer with a char outside the alphabet, so those
+// aren't counted towards what the next freeze takes
+void KmerIndex::add(const Genome& genome, int id)
+{
+    string frag = "";
+    long long lastInvalid = -1;         // the last position of a char outside the alphabet
+    long long numStored = 0;
+    for(long long i = 0; i < genome.length() - m_k + 1; i++){
+        genome.extract(i, m_k, frag);
+        for(long long j = (i == 0 ? 0 : m_k - 1); j < m_k; j++){
+            if(DNA5::encode(frag[j]) < 0)
+                lastInvalid = i + j;
+        }
+        if(lastInvalid >= i)
+            continue;
+        numStored++;
+        // a k-mer that's new to m_dna makes frozen nodes for whatever the
+        // frozen index doesn't already have
+        size_t added = m_dna.insert(frag, Posting(id, i));
+        if(added > 0){
+            size_t frozenPrefix = (m_frozenDna != nullptr ? m_frozenDna->existingPrefixLength(frag) : 0);
+            m_recentFrozenNodes += m_k - max(m_k - added, frozenPrefix);
+            if(frozenPrefix < (size_t)m_k)
+                m_recentLists++;
+        }
+    }
+    m_recentPostingBytes += numStored * maxFrozenPostingBytes(id, genome.length());
+}
+
+// the new nodes that k-mers whose existing prefixes have the lengths counted
+// in stopsAt can make: at depth d, no more than there are k-mers stopping
+// short of d, or than there are strings of d bases.  newLeaves gets the ones
+// at depth k.
+static double newNodeBound(const vector<long long>& stopsAt, int k, int alphabetSize, double& newLeaves){
+    double numNodes = 0;
+    double atDepth = 1;
+    long long shortOfDepth = 0;
+    for(int d = 1; d <= k; d++){
+        atDepth *= alphabetSize;
+        shortOfDepth += stopsAt[d-1];
+        newLeaves = min((double)shortOfDepth, atDepth);
+        numNodes += newLeaves;
+    }
+    return numNodes;
 }
 
-bool compareGenomeMatch(GenomeMatch g1, GenomeMatch g2){
-    if(g1.percentMatch == g2.percentMatch){
-        return g1.genomeName < g2.genomeName;   // if percents are the same, order by name
+// the same bound, tightened by what's already indexed: a k-mer only adds
+// pointer nodes below the part of it that's already in the pointer trie, and
+// frozen nodes below the part that's in either trie.  a genome without N has
+// only 4 bases to make strings from.  also works out what the next freeze
+// would need once genome is in.
+size_t KmerIndex::addCost(const Genome& genome, int id, size_t& freezeCostAfter) const
+{
+    long long numKmers = 0;                         // the ones the trie would store
+    vector<long long> stopsAt(m_k + 1, 0);          // k-mers whose existing part is this long
+    vector<long long> stopsAtFrozen(m_k + 1, 0);    // the same, counting the frozen trie too
+    bool hasN = false;
+    long long lastInvalid = -1;
+    string frag;
+    for(long long i = 0; i < genome.length() - m_k + 1; i++){
+        genome.extract(i, m_k, frag);
+        for(long long j = (i == 0 ? 0 : m_k - 1); j < m_k; j++){
+            int code = DNA5::encode(frag[j]);
+            hasN = hasN || code == DNA5::encode('N');
+            if(code < 0)
+                lastInvalid = i + j;
+        }
+        if(lastInvalid >= i)
+            continue;
+        numKmers++;
+        size_t existing = m_dna.existingPrefixLength(frag);
+        stopsAt[existing]++;
+        if(m_frozenDna != nullptr)
+            existing = max(existing, m_frozenDna->existingPrefixLength(frag));
+        stopsAtFrozen[existing]++;
     }
     
-    return g1.percentMatch > g2.percentMatch;   // order by percents in descending order
+    int alphabetSize = hasN ? DNA5::SIZE : DNA5::SIZE - 1;
+    double newLeaves = 0;
+    double numNodes = newNodeBound(stopsAt, m_k, alphabetSize, newLeaves);
+    double numFrozenNodes = newNodeBound(stopsAtFrozen, m_k, alphabetSize, newLeaves);
+    freezeCostAfter = freezeCost(numFrozenNodes, newLeaves, numKmers * maxFrozenPostingBytes(id, genome.length()));
+    return (size_t)(numKmers * 2 * sizeof(Posting) + numNodes * Trie<Posting, DNA5>::bytesPerNode());
+}
+
+// what freeze() allocates on top of the current index before it lets the old
+// one go: the new frozen trie and the new posting lists.  every key is k
+// bases long, so no level of the trie has more nodes than there are keys, and
+// each key has the one value, so the trie keeps no value starts.  the lists'
+// offsets are reserved at their exact size; their data is reserved at its
+// bound and then copied into an exact fit.  newNodes, newLists and
+// newPostingBytes are for a genome that isn't in m_dna yet.
+size_t KmerIndex::freezeCost(double newNodes, double newLists, size_t newPostingBytes) const
+{
+    double numNodes = newNodes + m_recentFrozenNodes + (m_frozenDna != nullptr ? m_frozenDna->numNodes() : 1);
+    double numLists = newLists + m_recentLists + m_postings.numLists();
+    double trieBytes = numNodes * FrozenTrie::bytesPerFrozenNode() + numLists * FrozenTrie::bytesPerFrozenLevelNode();
+    double dataBytes = m_postings.dataBytes() + m_recentPostingBytes + newPostingBytes;
+    return (size_t)(trieBytes + (numLists + 1) * sizeof(uint64_t) + 2 * dataBytes);
+}
+
+// the postings for a k-mer: the frozen index's come first, and since genomes
+// added after freezing have larger ids, an exact lookup stays sorted
+vector<Posting> KmerIndex::lookup(const string& kmer, bool exactMatchOnly, const vector<char>* candidates) const
+{
+    vector<Posting> hits;
+    if(m_frozenDna != nullptr){
+        vector<uint64_t> lists = m_frozenDna->findFrozenRanks(kmer, exactMatchOnly);
+        for(size_t i = 0; i < lists.size(); i++){
+            m_postings.decode(lists[i], hits, candidates);
+        }
+    }
+    vector<Posting> recent = m_dna.find(kmer, exactMatchOnly);
+    if(hits.empty())
+        return recent;
+    hits.insert(hits.end(), recent.begin(), recent.end());
+    return hits;
+}
+
+// moves every posting into the compressed, read-only form.  postings that were
+// already frozen are merged with the ones added since, so each k-mer still has
+// exactly one list.  the merge sees the keys in breadth-first order, old and
+// new alike, so the lists are made in the order of the new keys' ranks, and
+// the old keys come up in the order of their old lists.
+void KmerIndex::freeze(int numGenomes)
+{
+    if(m_frozenDna == nullptr)
+        m_frozenDna.reset(new FrozenTrie(m_frozenMemory));
+    PostingLists postings(m_frozenMemory);
+    postings.reserve(m_postings.numLists() + m_recentLists, m_postings.dataBytes() + m_recentPostingBytes);
+    uint64_t oldList = 0;
+    m_frozenDna->freezeWith(m_dna, [&](const FrozenTrie::Values& lists, const Trie<Posting, DNA5>::Values& recent,
+                                       FrozenTrie::Values& out){
+        out.push_back(HasList());
+        if(lists.empty()){
+            postings.add(recent);
+            return;
+        }
+        vector<Posting> merged;
+        m_postings.decode(oldList++, merged);
+        merged.insert(merged.end(), recent.begin(), recent.end());
+        postings.add(merged);
+    });
+    postings.shrink();
+    swap(m_postings, postings);
+    m_dna.reset();
+    m_numFrozenGenomes = numGenomes;
+    m_recentPostingBytes = 0;
+    m_recentFrozenNodes = 0;
+    m_recentLists = 0;
+}
+
+// an upper bound on what build() allocates once the chunks have been read,
+// given how many k-mers went into each part: the chunks' postings, a pointer
+// trie for each part being built at once, the frozen parts, and the index
+// they're spliced into.  at depth d a part can't have more nodes than it has
+// k-mers, or than there are strings of d bases after its prefix.  there's at
+// most a list per k-mer, and the parts' lists can take up twice their size.
+// each key has the one value, so the tries keep no value starts.
+size_t KmerIndex::buildCost(const vector<long long>& partSizes, int prefixLength, unsigned int numThreads, const vector<Genome>& genomes) const
+{
+    long long longest = 0;
+    for(size_t g = 0; g < genomes.size(); g++){
+        longest = max(longest, genomes[g].length());
+    }
+    double numKmers = 0, frozenBytes = 0;
+    vector<double> pointerBytes;
+    for(size_t p = 0; p < partSizes.size(); p++){
+        double n = partSizes[p];
+        double numNodes = prefixLength;
+        double atDepth = 1;
+        for(int d = prefixLength + 1; d <= m_k; d++){
+            atDepth *= DNA5::SIZE;
+            numNodes += min(n, atDepth);
+        }
+        numKmers += n;
+        pointerBytes.push_back(n * (2 * sizeof(Posting) + FrozenTrie::bytesPerFrozenLevelNode()) + numNodes * Trie<Posting, DNA5>::bytesPerNode());
+        frozenBytes += numNodes * FrozenTrie::bytesPerFrozenNode();
+    }
+    sort(pointerBytes.begin(), pointerBytes.end(), greater<double>());
+    double buildingBytes = 0;
+    for(size_t p = 0; p < pointerBytes.size() && p < numThreads; p++){
+        buildingBytes += pointerBytes[p];
+    }
+    double postingBytes = numKmers * (maxFrozenPostingBytes((int)genomes.size(), longest) + sizeof(uint64_t));
+    return (size_t)(numKmers * sizeof(Posting) + buildingBytes + 2 * frozenBytes + 3 * postingBytes);
+}
+
+// indexes genomes from scratch, frozen.  the genomes are read a chunk of
+// k-mers at a time, each chunk once, sorting its postings into parts by their
+// first few bases.  each part then gets its own trie, built and frozen on its
+// own thread, and the frozen parts are spliced into a single index.  returns
+// false, leaving the index empty, if that could take more than maxBytes.
+bool KmerIndex::build(const vector<Genome>& genomes, size_t maxBytes)
+{
+    typedef vector<Posting, CountingAllocator<Posting>> Postings;
+    int prefixLength = min(BUILD_PREFIX_LENGTH, m_k - 1);
+    int numParts = 1;
+    for(int i = 0; i < prefixLength; i++){
+        numParts *= DNA5::SIZE;
+    }
+    
+    struct Chunk{
+        int genome;
+        long long start, end;           // the k-mers starting at [start, end)
+    };
+    vector<Chunk> chunks;
+    double numKmers = 0;
+    for(size_t g = 0; g < genomes.size(); g++){
+        long long genomeKmers = genomes[g].length() - m_k + 1;
+        for(long long start = 0; start < genomeKmers; start += BUILD_CHUNK){
+            chunks.push_back(Chunk{(int)g, start, min(genomeKmers, start + BUILD_CHUNK)});
+        }
+        numKmers += max(0LL, genomeKmers);
+    }
+    
+    // reading the chunks takes a posting per k-mer, and the ones being read
+    // can take up to twice their share while they grow
+    unsigned int numThreads = max(1u, thread::hardware_concurrency());
+    if(numKmers * sizeof(Posting) + (double)numThreads * BUILD_CHUNK * 2 * sizeof(Posting) > maxBytes)
+        return false;
+    auto onAllThreads = [numThreads](auto work){
+        vector<thread> workers;
+        for(unsigned int t = 1; t < numThreads; t++){
+            workers.push_back(thread(work));
+        }
+        work();
+        for(size_t t = 0; t < workers.size(); t++){
+            workers[t].join();
+        }
+    };
+    
+    // each chunk's postings, by part.  going through the chunks in order keeps
+    // every part's postings sorted.
+    vector<vector<Postings>> chunkParts(chunks.size());
+    atomic<size_t> nextChunk(0);
+    onAllThreads([&](){
+        string bases;
+        for(size_t c = nextChunk++; c < chunks.size(); c = nextChunk++){
+            const Chunk& chunk = chunks[c];
+            genomes[chunk.genome].extract(chunk.start, chunk.end - chunk.start + m_k - 1, bases);
+            vector<Postings>& parts = chunkParts[c];
+            parts.assign(numParts, Postings(CountingAllocator<Posting>(m_indexMemory)));
+            for(long long i = 0; i < chunk.end - chunk.start; i++){
+                int part = 0;
+                for(int j = 0; j < prefixLength && part >= 0; j++){
+                    int code = DNA5::encode(bases[i+j]);
+                    part = (code < 0) ? -1 : part * DNA5::SIZE + code;
+                }
+                if(part >= 0)
+                    parts[part].push_back(Posting(chunk.genome, chunk.start + i));
+            }
+            for(int p = 0; p < numParts; p++){
+                parts[p].shrink_to_fit();
+            }
+        }
+    });
+    
+    vector<long long> partSizes(numParts, 0);
+    for(size_t c = 0; c < chunks.size(); c++){
+        for(int p = 0; p < numParts; p++){
+            partSizes[p] += chunkParts[c][p].size();
+        }
+    }
+    if(buildCost(partSizes, prefixLength, numThreads, genomes) > maxBytes)
+        return false;
+    
+    vector<unique_ptr<FrozenTrie>> frozenParts(numParts);
+    vector<PostingLists> partLists(numParts, PostingLists(m_frozenMemory));
+    atomic<int> nextPart(0);
+    onAllThreads([&](){
+        string frag;
+        for(int p = nextPart++; p < numParts; p = nextPart++){
+            Trie<Posting, DNA5> part(m_indexMemory);
+            for(size_t c = 0; c < chunks.size(); c++){
+                Postings& postings = chunkParts[c][p];
+                for(size_t i = 0; i < postings.size(); i++){
+                    genomes[postings[i].genome()].extract(postings[i].position(), m_k, frag);
+                    part.insert(frag, postings[i]);
+                }
+                Postings(CountingAllocator<Posting>(m_indexMemory)).swap(postings);
+            }
+            frozenParts[p].reset(new FrozenTrie(m_frozenMemory));
+            frozenParts[p]->freezeWith(part, [&](const FrozenTrie::Values&, const Trie<Posting, DNA5>::Values& recent, FrozenTrie::Values& out){
+                partLists[p].add(recent);
+                out.push_back(HasList());
+            });
+        }
+    });
+    chunkParts.clear();
+    
+    // every key is at depth k, where the spliced trie has each part's keys in
+    // turn, so the parts' lists just go one after another
+    size_t numLists = 0, numBytes = 0;
+    for(int p = 0; p < numParts; p++){
+        numLists += partLists[p].numLists();
+        numBytes += partLists[p].dataBytes();
+    }
+    PostingLists postings(m_frozenMemory);
+    postings.reserve(numLists, numBytes);
+    vector<FrozenTrie*> parts(numParts);
+    for(int p = 0; p < numParts; p++){
+        postings.append(partLists[p]);
+        parts[p] = frozenParts[p].get();
+    }
+    unique_ptr<FrozenTrie> frozen(new FrozenTrie(m_frozenMemory));
+    frozen->freezeParts(parts, prefixLength, [](size_t, HasList key){
+        return key;
+    });
+    frozenParts.clear();
+    
+    m_frozenDna.swap(frozen);
+    swap(m_postings, postings);
+    m_dna.reset();
+    m_numFrozenGenomes = genomes.size();
+    m_recentPostingBytes = 0;
+    m_recentFrozenNodes = 0;
+    m_recentLists = 0;
+    return true;
+}
+
+// half-width, in percent, of an Agresti-Coull confidence interval for the match
+// rate after finding hits in numHits of numSampled fragments drawn without
+// replacement from numFragments.  unlike the plain normal approximation this
+// doesn't collapse to 0 when numHits is 0 or numSampled.
+double approxPercentError(long long numHits, long long numSampled, long long numFragments){
+    if(numSampled >= numFragments)
+        return 0;
+    double n = numSampled + APPROX_Z*APPROX_Z;
+    double p = (numHits + APPROX_Z*APPROX_Z/2) / n;
+    double finiteCorrection = (double)(numFragments - numSampled)/(numFragments - 1);
+    return APPROX_Z * sqrt(p*(1-p)/n * finiteCorrection) * 100;
 }
 
 class GenomeMatcherImpl
 {
 public:
     GenomeMatcherImpl(int minSearchLength);
-    void addGenome(const Genome& genome);
+    bool addGenome(const Genome& genome);
     int minimumSearchLength() const;
     bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const;
+    bool findGenomesWithThisDNAUncached(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const;
+    bool findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatchById>& results) const;
+    bool findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const;
+    int numGenomes() const;
+    const string& genomeName(int genomeId) const;
+    void setRelatedGenomesPrefilter(bool enabled, double slackPercent);
+    bool freezeIndex();
+    bool setMinimumSearchLength(int minSearchLength);
+    bool addSearchIndex(int searchLength);
+    void removeSearchIndex(int searchLength);
+    vector<int> searchIndexLengths() const;
+    void setFragmentCacheSize(size_t capacityBytes);
+    FragmentCacheStats fragmentCacheStats() const;
+    void setMemoryBudget(size_t budgetBytes);
+    MemoryStats memoryStats() const;
 private:
+    typedef vector<int, CountingAllocator<int>> GenomeIds;
+    typedef unordered_map<uint64_t, GenomeIds, hash<uint64_t>, equal_to<uint64_t>,
+                          CountingAllocator<pair<const uint64_t, GenomeIds>>> SketchIndex;
+    
+    // what each part of the library is using.  the counters have to be
+    // declared before the structures that allocate through them.
+    MemoryCounter m_indexMemory;
+    MemoryCounter m_frozenIndexMemory;
+    MemoryCounter m_sketchMemory;
+    size_t m_sequenceBytes;
+    size_t m_memoryBudget;                  // 0 for no budget
+    
     int m_minSearchLength;
     vector<Genome> m_genomes;
+    vector<string> m_names;                 // m_names[id] is m_genomes[id].name(), fetched once
+    
+    // in increasing order of k; m_indexes[0] is the one for m_minSearchLength
+    vector<unique_ptr<KmerIndex>> m_indexes;
+    
+    // maps each sketch hash to the genomes whose sketch contains it
+    SketchIndex m_sketches;
+    bool m_prefilter;
+    double m_prefilterSlack;
     
-    // the Trie maps strings to pairs of ints       (position of genome in vector, position within genome)
-    Trie<pair<int, int>> m_dna;
+    // LRU cache of findMatches() results, keyed by fragment, minimumLength and exactMatchOnly
+    struct CacheEntry{
+        string key;
+        bool found;
+        vector<DNAMatchById> matches;
+        size_t bytes;
+    };
+    mutable mutex m_cacheMutex;
+    mutable list<CacheEntry> m_cache;                   // most recently used at the front
+    mutable unordered_map<string, list<CacheEntry>::iterator> m_cacheIndex;
+    size_t m_cacheCapacity;
+    mutable size_t m_cacheBytes;
+    mutable size_t m_cacheHits;
+    mutable size_t m_cacheMisses;
+    
+    bool findMatches(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches, const vector<char>* candidates) const;
+    bool searchMatches(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches, const vector<char>* candidates) const;
+    const KmerIndex& indexFor(int minimumLength) const;
+    KmerIndex* buildIndex(int k);
+    void chainSeeds(const KmerIndex& index, const string& fragment, int minimumLength, bool exactMatchOnly, vector<Posting>& starts) const;
+    void sortRelated(vector<GenomeMatchById>& results) const;
+    void nameRelated(const vector<GenomeMatchById>& byId, vector<GenomeMatch>& results) const;
+    void clearCache();
+    size_t addCost(const Genome& genome, size_t& freezeCostAfter) const;
+    size_t freezeCost() const;
+    void addSketch(const Genome& genome, int id);
+    bool selectCandidates(const Genome& query, int fragmentMatchLength, double matchPercentThreshold, vector<char>& candidates) const;
 };
 
 GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
-:m_minSearchLength(minSearchLength) {}
+:m_sequenceBytes(0), m_memoryBudget(0), m_minSearchLength(minSearchLength),
+ m_sketches(0, hash<uint64_t>(), equal_to<uint64_t>(), &m_sketchMemory),
+ m_prefilter(false), m_prefilterSlack(0),
+ m_cacheCapacity(0), m_cacheBytes(0), m_cacheHits(0), m_cacheMisses(0)
+{
+    m_indexes.push_back(unique_ptr<KmerIndex>(new KmerIndex(minSearchLength, &m_indexMemory, &m_frozenIndexMemory)));
+}
 
 int GenomeMatcherImpl::minimumSearchLength() const
 {
     return m_minSearchLength;
 }
 
-void GenomeMatcherImpl::addGenome(const Genome& genome)
+bool GenomeMatcherImpl::addGenome(const Genome& genome)
 {
     int pos = m_genomes.size();
-    string frag = "";
     
+    // Postings can't describe genomes past these limits
+    if(pos >= MAX_GENOMES || genome.length() > MAX_GENOME_LENGTH)
+        return false;
+    
+    // the genome has to fit in the budget along with what it would then take
+    // to freeze the index, so the library can always be compacted.  if it
+    // doesn't, compact what's already indexed and try again; if it still
+    // doesn't, leave the library as it is.  freezing empties the pointer
+    // tries, so the genome has to be costed again afterwards.
+    if(m_memoryBudget > 0){
+        bool unfrozen = false;
+        for(size_t i = 0; i < m_indexes.size(); i++){
+            unfrozen = unfrozen || m_indexes[i]->numFrozenGenomes() < pos;
+        }
+        size_t freezeCostAfter;
+        size_t cost = addCost(genome, freezeCostAfter);
+        if(memoryStats().totalBytes() + cost + freezeCostAfter > m_memoryBudget && unfrozen){
+            freezeIndex();
+            cost = addCost(genome, freezeCostAfter);
+        }
+        if(memoryStats().totalBytes() + cost + freezeCostAfter > m_memoryBudget)
+            return false;
+    }
     
     m_genomes.push_back(genome);
+    m_names.push_back(genome.name());
+    m_sequenceBytes += genome.length() + 2 * genome.name().length();
+    clearCache();                           // cached results don't know about the new genome
+    
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        m_indexes[i]->add(genome, pos);
+    }
+    addSketch(genome, pos);
+    return true;
+}
+
+void GenomeMatcherImpl::addSketch(const Genome& genome, int id)
+{
+    vector<uint64_t> sketch;
+    sketchGenome(genome, SKETCH_K, sketch);
+    for(size_t i = 0; i < sketch.size(); i++){
+        SketchIndex::iterator it = m_sketches.find(sketch[i]);
+        if(it == m_sketches.end())
+            it = m_sketches.insert(make_pair(sketch[i], GenomeIds(&m_sketchMemory))).first;
+        it->second.push_back(id);
+    }
+}
+
+// an upper bound on what adding genome takes before the next freeze, and on
+// what that freeze would then need (the sketch's share is only an estimate)
+size_t GenomeMatcherImpl::addCost(const Genome& genome, size_t& freezeCostAfter) const
+{
+    size_t cost = genome.length() + 2 * genome.name().length();
+    cost += (genome.length() / SKETCH_SCALE + 1) * (sizeof(SketchIndex::value_type) + 2 * sizeof(void*) + sizeof(int));
+    freezeCostAfter = 0;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        size_t indexFreezeCost;
+        cost += m_indexes[i]->addCost(genome, m_genomes.size(), indexFreezeCost);
+        freezeCostAfter = max(freezeCostAfter, indexFreezeCost);
+    }
+    return cost;
+}
+
+// the indexes are frozen one at a time, and each lets go of its old form
+// before the next starts, so the peak is the largest single freeze
+size_t GenomeMatcherImpl::freezeCost() const
+{
+    size_t cost = 0;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        cost = max(cost, m_indexes[i]->freezeCost());
+    }
+    return cost;
+}
+
+// the index with the longest k-mers that a search for minimumLength bases can
+// seed from
+const KmerIndex& GenomeMatcherImpl::indexFor(int minimumLength) const
+{
+    int best = 0;
+    for(size_t i = 1; i < m_indexes.size() && m_indexes[i]->k() <= minimumLength; i++){
+        best = i;
+    }
+    return *m_indexes[best];
+}
+
+// indexes the whole library again for k, or returns nullptr if that would
+// go over the memory budget
+KmerIndex* GenomeMatcherImpl::buildIndex(int k)
+{
+    size_t room = SIZE_MAX;
+    if(m_memoryBudget > 0){
+        size_t total = memoryStats().totalBytes();
+        room = (total < m_memoryBudget ? m_memoryBudget - total : 0);
+    }
+    unique_ptr<KmerIndex> index(new KmerIndex(k, &m_indexMemory, &m_frozenIndexMemory));
+    if(!index->build(m_genomes, room))
+        return nullptr;
+    return index.release();
+}
+
+// re-keys the library for a new minimum search length from the genomes it
+// already holds.  indexes for shorter k-mers can't be used any more and are
+// dropped; if there's already an index for k it just takes over.
+bool GenomeMatcherImpl::setMinimumSearchLength(int minSearchLength)
+{
+    if(minSearchLength < 1)
+        return false;
+    
+    int existing = -1;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        if(m_indexes[i]->k() == minSearchLength)
+            existing = i;
+    }
+    if(existing < 0){
+        KmerIndex* index = buildIndex(minSearchLength);
+        if(index == nullptr)
+            return false;
+        m_indexes.push_back(unique_ptr<KmerIndex>(index));
+    }
     
-    for(int i = 0; i < genome.length() - m_minSearchLength + 1; i++){
-        pair<int, int> p;
-        p.first = pos;
-        p.second = i;
-        genome.extract(i, m_minSearchLength, frag);
-        m_dna.insert(frag, p);
+    vector<unique_ptr<KmerIndex>> kept;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        if(m_indexes[i]->k() >= minSearchLength)
+            kept.push_back(std::move(m_indexes[i]));
+    }
+    sort(kept.begin(), kept.end(), [](const unique_ptr<KmerIndex>& a, const unique_ptr<KmerIndex>& b){
+        return a->k() < b->k();
+    });
+    m_indexes.swap(kept);
+    kept.clear();
+    m_minSearchLength = minSearchLength;
+    clearCache();
+    return true;
+}
+
+// keeps another index resident so searches for at least searchLength bases
+// can seed from longer, more selective k-mers
+bool GenomeMatcherImpl::addSearchIndex(int searchLength)
+{
+    if(searchLength < m_minSearchLength)
+        return false;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        if(m_indexes[i]->k() == searchLength)
+            return true;
+    }
+    
+    KmerIndex* index = buildIndex(searchLength);
+    if(index == nullptr)
+        return false;
+    int i = m_indexes.size();
+    m_indexes.push_back(unique_ptr<KmerIndex>(index));
+    for( ; i > 0 && m_indexes[i-1]->k() > searchLength; i--){
+        m_indexes[i].swap(m_indexes[i-1]);
+    }
+    return true;
+}
+
+// the index for the minimum search length always stays
+void GenomeMatcherImpl::removeSearchIndex(int searchLength)
+{
+    for(size_t i = 1; i < m_indexes.size(); i++){
+        if(m_indexes[i]->k() == searchLength){
+            m_indexes.erase(m_indexes.begin() + i);
+            return;
+        }
     }
 }
 
+vector<int> GenomeMatcherImpl::searchIndexLengths() const
+{
+    vector<int> lengths;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        lengths.push_back(m_indexes[i]->k());
+    }
+    return lengths;
+}
+
+void GenomeMatcherImpl::setRelatedGenomesPrefilter(bool enabled, double slackPercent)
+{
+    m_prefilter = enabled;
+    m_prefilterSlack = slackPercent;
+}
+
+// estimates what fraction of the query's k-mers each library genome contains and
+// marks the genomes that could plausibly reach matchPercentThreshold.
+// returns false if the query is too short to have a usable sketch, or if its
+// fragments are shorter than the sketch k-mers and so can't be judged by them.
+bool GenomeMatcherImpl::selectCandidates(const Genome& query, int fragmentMatchLength, double matchPercentThreshold, vector<char>& candidates) const
+{
+    if(fragmentMatchLength < SKETCH_K)
+        return false;
+    
+    vector<uint64_t> sketch;
+    sketchGenome(query, SKETCH_K, sketch);
+    if(sketch.size() == 0)
+        return false;
+    
+    vector<int> shared(m_genomes.size(), 0);
+    for(size_t i = 0; i < sketch.size(); i++){
+        SketchIndex::const_iterator it = m_sketches.find(sketch[i]);
+        if(it == m_sketches.end())
+            continue;
+        for(size_t j = 0; j < it->second.size(); j++){
+            shared[it->second[j]]++;
+        }
+    }
+    
+    candidates.assign(m_genomes.size(), false);
+    for(size_t i = 0; i < m_genomes.size(); i++){
+        double containment = (double)shared[i]/sketch.size() * 100;
+        if(containment + m_prefilterSlack >= matchPercentThreshold)
+            candidates[i] = true;
+    }
+    return true;
+}
+
+int GenomeMatcherImpl::numGenomes() const
+{
+    return m_genomes.size();
+}
+
+const string& GenomeMatcherImpl::genomeName(int genomeId) const
+{
+    return m_names[genomeId];
+}
+
 bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+{
+    vector<DNAMatchById> byId;
+    bool found = findMatches(fragment, minimumLength, exactMatchOnly, byId, nullptr);
+    
+    // names are only looked up now, once per reported match
+    matches.clear();
+    for(size_t i = 0; found && i < byId.size(); i++){
+        DNAMatch m;
+        m.genomeName = m_names[byId[i].genomeId];
+        m.length = byId[i].length;
+        m.position = byId[i].position;
+        matches.push_back(m);
+    }
+    return found;
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const
+{
+    return findMatches(fragment, minimumLength, exactMatchOnly, matches, nullptr);
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNAUncached(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const
+{
+    return searchMatches(fragment, minimumLength, exactMatchOnly, matches, nullptr);
+}
+
+// if candidates is not null, only genomes marked in it are verified and reported.
+// only unrestricted searches go through the cache.
+bool GenomeMatcherImpl::findMatches(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches, const vector<char>* candidates) const
+{
+    if(m_cacheCapacity == 0 || candidates != nullptr)
+        return searchMatches(fragment, minimumLength, exactMatchOnly, matches, candidates);
+    
+    string key = fragment;
+    key += '\0';
+    key += to_string(minimumLength);
+    key += exactMatchOnly ? 'e' : 's';
+    
+    {
+        lock_guard<mutex> lock(m_cacheMutex);
+        unordered_map<string, list<CacheEntry>::iterator>::iterator it = m_cacheIndex.find(key);
+        if(it != m_cacheIndex.end()){
+            m_cacheHits++;
+            m_cache.splice(m_cache.begin(), m_cache, it->second);      // mark as most recently used
+            matches = it->second->matches;
+            return it->second->found;
+        }
+        m_cacheMisses++;
+    }
+    
+    // search without holding the lock so other threads can keep using the cache
+    bool found = searchMatches(fragment, minimumLength, exactMatchOnly, matches, nullptr);
+    
+    CacheEntry e;
+    e.key = key;
+    e.found = found;
+    e.matches = matches;
+    e.bytes = sizeof(CacheEntry) + 2*key.size() + 64;       // key is stored twice, plus node overhead
+    e.bytes += matches.size() * sizeof(DNAMatchById);
+    if(!found)
+        e.matches.clear();
+    
+    lock_guard<mutex> lock(m_cacheMutex);
+    if(e.bytes > m_cacheCapacity || m_cacheIndex.count(key) > 0)
+        return found;
+    while(m_cacheBytes + e.bytes > m_cacheCapacity){     // evict least recently used
+        m_cacheBytes -= m_cache.back().bytes;
+        m_cacheIndex.erase(m_cache.back().key);
+        m_cache.pop_back();
+    }
+    m_cache.push_front(e);
+    m_cacheIndex[key] = m_cache.begin();
+    m_cacheBytes += e.bytes;
+    return found;
+}
+
+// leaves the index as it is if freezing would need more than the budget has left
+bool GenomeMatcherImpl::freezeIndex()
+{
+    if(m_memoryBudget > 0 && memoryStats().totalBytes() + freezeCost() > m_memoryBudget)
+        return false;
+    for(size_t i = 0; i < m_indexes.size(); i++){
+        m_indexes[i]->freeze(m_genomes.size());
+    }
+    return true;
+}
+
+// finds every (genome, position) where fragment could match for at least
+// minimumLength bases.  the first minimumLength bases are cut into
+// non-overlapping k-mer seeds, each looked up exactly.  a real match has at
+// most one SNP in that stretch, so it hits every seed but at most one; that
+// means it shows up in the rarest seed (exact) or one of the two rarest (SNPs),
+// so only those seeds propose starting positions.  the remaining seeds, rarest
+// first, then vote on each start and starts that miss too many are dropped
+// before anything is extracted from a genome.
+void GenomeMatcherImpl::chainSeeds(const KmerIndex& index, const string& fragment, int minimumLength, bool exactMatchOnly, vector<Posting>& starts) const
+{
+    const int k = index.k();
+    const int numSeeds = minimumLength / k;
+    const int errorsAllowed = exactMatchOnly ? 0 : 1;
+    
+    // each seed's hits come back ordered by genome and then position, since
+    // that's the order addGenome inserts them in
+    vector<vector<Posting>> seedHits(numSeeds);
+    vector<int> order(numSeeds);
+    for(int j = 0; j < numSeeds; j++){
+        seedHits[j] = index.lookup(fragment.substr(j*k, k), true);
+        order[j] = j;
+    }
+    sort(order.begin(), order.end(), [&seedHits](int a, int b){
+        return seedHits[a].size() < seedHits[b].size();
+    });
+    
+    starts.clear();
+    for(int r = 0; r <= errorsAllowed; r++){
+        int j = order[r];
+        for(size_t i = 0; i < seedHits[j].size(); i++){
+            long long start = seedHits[j][i].position() - j*k;
+            if(start >= 0)
+                starts.push_back(Posting(seedHits[j][i].genome(), start));
+        }
+    }
+    sort(starts.begin(), starts.end());
+    starts.erase(unique(starts.begin(), starts.end()), starts.end());
+    
+    // chain: a start survives while it has missed no more than errorsAllowed seeds
+    vector<int> misses(starts.size(), 0);
+    vector<char> missedFirst(starts.size(), false);
+    for(int r = 0; r < numSeeds; r++){
+        int j = order[r];
+        for(size_t c = 0; c < starts.size(); c++){
+            if(misses[c] > errorsAllowed)
+                continue;
+            Posting want(starts[c].genome(), starts[c].position() + j*k);
+            if(!binary_search(seedHits[j].begin(), seedHits[j].end(), want)){
+                misses[c]++;
+                if(j == 0)
+                    missedFirst[c] = true;
+            }
+        }
+    }
+    
+    int kept = 0;
+    for(size_t c = 0; c < starts.size(); c++){
+        if(misses[c] > errorsAllowed)
+            continue;
+        // the trie never lets a SNP fall on the very first base, so neither do we
+        if(missedFirst[c]){
+            string first;
+            m_genomes[starts[c].genome()].extract(starts[c].position(), 1, first);
+            if(first[0] != fragment[0])
+                continue;
+        }
+        starts[kept++] = starts[c];
+    }
+    starts.resize(kept);
+}
+
+bool GenomeMatcherImpl::searchMatches(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches, const vector<char>* candidates) const
 {
     // return false for invalid input (lengths lower than minSearchLength)
     if(fragment.length() < minimumLength || minimumLength < m_minSearchLength){
         return false;
     }
     
-    // get pairs with matching prefixes
-    vector<pair<int, int>> dnaFragMatches;
-    dnaFragMatches = m_dna.find(fragment.substr(0, m_minSearchLength), exactMatchOnly);
+    // get pairs with matching prefixes; long fragments are seeded all along
+    // their required length instead of just at the start
+    const KmerIndex& index = indexFor(minimumLength);
+    vector<Posting> dnaFragMatches;
+    if(minimumLength >= CHAIN_MIN_SEEDS * index.k())
+        chainSeeds(index, fragment, minimumLength, exactMatchOnly, dnaFragMatches);
+    else
+        dnaFragMatches = index.lookup(fragment.substr(0, index.k()), exactMatchOnly, candidates);
     
     // returns immdiately if there are no prefix matches
     if(dnaFragMatches.size() == 0)
@@ -89,23 +975,26 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
         // maps genome id (the first index) to a list of pairs (position, length)
         // O(1) to add a pair into a list in the map
     
-    unordered_map<int, list<pair<int, int>>> genomeMatchInfo;
+    unordered_map<int, list<pair<long long, int>>> genomeMatchInfo;
     matches.clear();
     
     for(int i = 0; i < dnaFragMatches.size(); i++){
-        int curGenome = dnaFragMatches[i].first;
+        int curGenome = dnaFragMatches[i].genome();
+        long long curPos = dnaFragMatches[i].position();
+        if(candidates != nullptr && !(*candidates)[curGenome])
+            continue;
         
         bool errorsAllowed = !exactMatchOnly;
         int searchLength = fragment.length();
         string genomeFrag;
         
         // check whether extracting for the entire fragment's size would be out of bounds of the genome
-        if(dnaFragMatches[i].second + fragment.length() > m_genomes[curGenome].length()){
-            searchLength = m_genomes[curGenome].length() - dnaFragMatches[i].second;
+        if(curPos + (long long)fragment.length() > m_genomes[curGenome].length()){
+            searchLength = m_genomes[curGenome].length() - curPos;
         }
         
         // extract the most DNA bases as possible up to a max of fragment's length
-        m_genomes[curGenome].extract(dnaFragMatches[i].second, searchLength, genomeFrag);
+        m_genomes[curGenome].extract(curPos, searchLength, genomeFrag);
         
         // loop until fragment and genomeFrag aren't equal
         int curLength = 0;
@@ -121,25 +1010,24 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
             curLength++;
         }
         
-        // find()'s pair is in the form (genome, position)
         // genomeMatchInfo's pair is in the form (position, length)
-        pair<int, int> p;
-        p.first = dnaFragMatches[i].second;
+        pair<long long, int> p;
+        p.first = curPos;
         p.second = curLength;
         
         genomeMatchInfo[curGenome].push_back(p);
     }
 
     // add all matches to the matches vector
-    for(unordered_map<int, list<pair<int,int>>>::iterator i = genomeMatchInfo.begin();
+    for(unordered_map<int, list<pair<long long, int>>>::iterator i = genomeMatchInfo.begin();
         i != genomeMatchInfo.end(); i++){
         // process the max length and add the longest one
         
         int curID = i->first;
-        int longestPos = -1;
+        long long longestPos = -1;
         int longest = 0;
         
-        for(list<pair<int,int>>::iterator it = genomeMatchInfo[curID].begin(); it != genomeMatchInfo[curID].end(); it++){
+        for(list<pair<long long, int>>::iterator it = genomeMatchInfo[curID].begin(); it != genomeMatchInfo[curID].end(); it++){
             if(it->second == longest){
                 if(it->first < longestPos){     // pick the earliest position of their lengths are equal
                     longestPos = it->first;
@@ -151,8 +1039,8 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
         }
         
         if(longest >= minimumLength){
-            DNAMatch m;
-            m.genomeName = m_genomes[curID].name();
+            DNAMatchById m;
+            m.genomeId = curID;
             m.position = longestPos;
             m.length = longest;
             matches.push_back(m);
@@ -166,45 +1054,368 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
 
 bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
 {
-    int numIterations = query.length()/fragmentMatchLength;
-    map<string, int> numMatches;            // use a map to maintain the counts for the number of matches
+    vector<GenomeMatchById> byId;
+    findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, byId);
+    nameRelated(byId, results);
+    return results.size() > 0;
+}
+
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const
+{
+    long long numIterations = query.length()/fragmentMatchLength;
+    vector<long long> numMatches(m_genomes.size(), 0);     // numMatches[id] counts fragments found in that genome
+    
+    // screen out genomes that can't be related before doing any fragment searches
+    vector<char> candidates;
+    bool filtered = m_prefilter && selectCandidates(query, fragmentMatchLength, matchPercentThreshold, candidates);
+    if(filtered && find(candidates.begin(), candidates.end(), true) == candidates.end())
+        numIterations = 0;
     
-    for(int i = 0; i < numIterations; i++){
+    for(long long i = 0; i < numIterations; i++){
         string frag;
-        vector<DNAMatch> matches;
+        vector<DNAMatchById> matches;
         
         query.extract(i*fragmentMatchLength, fragmentMatchLength, frag);
-        findGenomesWithThisDNA(frag, fragmentMatchLength, exactMatchOnly, matches);
+        findMatches(frag, fragmentMatchLength, exactMatchOnly, matches, filtered ? &candidates : nullptr);
         
-        for(int i = 0; i < matches.size(); i++){
-            // first check if that genome already exists in the map
-            map<string,int>::iterator it = numMatches.find(matches[i].genomeName);
-            if(it == numMatches.end()){
-                numMatches[matches[i].genomeName] = 1;
-            }else{
-                numMatches[matches[i].genomeName]++;
-            }
+        for(size_t j = 0; j < matches.size(); j++){
+            numMatches[matches[j].genomeId]++;
         }
     }
     
     results.clear();
-    for(map<string, int>::iterator it = numMatches.begin(); it != numMatches.end(); it++){
-        double percent = (double)(*it).second/numIterations * 100 ; // percent is 0-100
+    for(size_t id = 0; id < numMatches.size(); id++){
+        if(numMatches[id] == 0)
+            continue;
+        double percent = (double)numMatches[id]/numIterations * 100 ; // percent is 0-100
         if(percent >= matchPercentThreshold){
-            GenomeMatch g;
-            g.genomeName = (*it).first;
+            GenomeMatchById g;
+            g.genomeId = id;
             g.percentMatch = percent;
             
             results.push_back(g);
         }
     }
-    sort(results.begin(), results.end(), compareGenomeMatch);
+    sortRelated(results);
     
     if(results.size() > 0)
         return true;
     return false;
 }
 
+bool GenomeMatcherImpl::findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatch>& results) const
+{
+    vector<GenomeMatchById> byId;
+    findRelatedGenomesApprox(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, maxPercentError, byId);
+    nameRelated(byId, results);
+    return results.size() > 0;
+}
+
+bool GenomeMatcherImpl::findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatchById>& results) const
+{
+    long long numFragments = query.length()/fragmentMatchLength;
+    vector<long long> numMatches(m_genomes.size(), 0);
+    results.clear();
+    
+    vector<char> candidates;
+    bool filtered = m_prefilter && selectCandidates(query, fragmentMatchLength, matchPercentThreshold, candidates);
+    if(numFragments == 0 || (filtered && find(candidates.begin(), candidates.end(), true) == candidates.end()))
+        return false;
+    
+    // visit the fragments in a shuffled order, so the fragments checked so far are
+    // always a uniform sample.  the seed is fixed so repeated queries agree.
+    // the shuffle is a Fisher-Yates run one step per fragment visited, with
+    // only the slots it has swapped stored, so a query that stops early never
+    // pays for its full length.
+    mt19937 rng(numFragments);
+    unordered_map<long long, long long> swapped;      // slot -> fragment, where that isn't slot itself
+    auto nextFragment = [&](long long slot){
+        long long other = uniform_int_distribution<long long>(slot, numFragments - 1)(rng);
+        auto at = [&](long long i){
+            unordered_map<long long, long long>::const_iterator it = swapped.find(i);
+            return it == swapped.end() ? i : it->second;
+        };
+        long long fragment = at(other);
+        long long displaced = at(slot);
+        swapped[other] = displaced;
+        swapped.erase(slot);                        // never looked at again
+        return fragment;
+    };
+    
+    long long numSampled = 0;
+    while(numSampled < numFragments){
+        long long batchEnd = min(numFragments, numSampled + APPROX_BATCH);
+        for(; numSampled < batchEnd; numSampled++){
+            string frag;
+            vector<DNAMatchById> matches;
+            
+            query.extract(nextFragment(numSampled)*fragmentMatchLength, fragmentMatchLength, frag);
+            findMatches(frag, fragmentMatchLength, exactMatchOnly, matches, filtered ? &candidates : nullptr);
+            for(size_t i = 0; i < matches.size(); i++){
+                numMatches[matches[i].genomeId]++;
+            }
+        }
+        if(numSampled < APPROX_MIN_SAMPLE)
+            continue;
+        
+        // stop once every genome's interval is narrow enough, including the
+        // genomes that haven't had a single hit yet
+        double worstError = approxPercentError(0, numSampled, numFragments);
+        for(size_t id = 0; id < numMatches.size(); id++){
+            if(numMatches[id] > 0)
+                worstError = max(worstError, approxPercentError(numMatches[id], numSampled, numFragments));
+        }
+        if(worstError <= maxPercentError)
+            break;
+    }
+    
+    for(size_t id = 0; id < numMatches.size(); id++){
+        if(numMatches[id] == 0)
+            continue;
+        double percent = (double)numMatches[id]/numSampled * 100;
+        if(percent >= matchPercentThreshold){
+            GenomeMatchById g;
+            g.genomeId = id;
+            g.percentMatch = percent;
+            g.percentError = approxPercentError(numMatches[id], numSampled, numFragments);
+            results.push_back(g);
+        }
+    }
+    sortRelated(results);
+    
+    if(results.size() > 0)
+        return true;
+    return false;
+}
+
+bool GenomeMatcherImpl::findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    vector<GenomeMatchById> byId;
+    findRelatedGenomesSliding(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, byId);
+    nameRelated(byId, results);
+    return results.size() > 0;
+}
+
+// every query window [i, i+fragmentMatchLength) is seeded with the k-mer at i.  a
+// seed hit at genome position p puts the window on diagonal d = p - i of that
+// genome, and consecutive windows on the same diagonal share all but one base,
+// so each diagonal remembers how far it has been compared and where its
+// mismatches were.  every base pair on a diagonal is compared at most once, no
+// matter how many windows use it.
+bool GenomeMatcherImpl::findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const
+{
+    results.clear();
+    long long numWindows = query.length() - fragmentMatchLength + 1;
+    if(fragmentMatchLength < m_minSearchLength || numWindows <= 0)
+        return false;
+    
+    vector<char> candidates;
+    bool filtered = m_prefilter && selectCandidates(query, fragmentMatchLength, matchPercentThreshold, candidates);
+    if(filtered && find(candidates.begin(), candidates.end(), true) == candidates.end())
+        return false;
+    
+    string bases;
+    query.extract(0, query.length(), bases);
+    
+    // at most one SNP is allowed, so a diagonal never needs to remember more than
+    // the first two mismatches at or after the current window
+    struct Diagonal{
+        long long scannedTo = -1;       // query positions before this have been compared
+        int numMismatches = 0;
+        long long mismatches[2];        // query positions that didn't match, in order
+    };
+    unordered_map<uint64_t, Diagonal> diagonals;
+    
+    // seed lookups for k-mers seen earlier in the query are reused, keyed by their
+    // rolling 2-bit encoding (only possible when k fits in 64 bits and has no N)
+    unordered_map<uint64_t, vector<Posting>> seedCache;
+    const KmerIndex& index = indexFor(fragmentMatchLength);
+    const int k = index.k();
+    const bool rolling = k <= 32;
+    const uint64_t mask = (k == 32) ? UINT64_MAX : ((uint64_t)1 << (2*k)) - 1;
+    uint64_t kmer = 0;
+    int valid = 0;
+    
+    const int errorsAllowed = exactMatchOnly ? 0 : 1;
+    vector<long long> numMatches(m_genomes.size(), 0);
+    vector<long long> lastWindow(m_genomes.size(), -1);    // last window already counted for each genome
+    
+    for(long long i = 0; i < numWindows; i++){
+        // forget diagonals we've moved past and seeds we may not see again, so
+        // memory stays bounded on long queries
+        if(i % SLIDING_PRUNE_INTERVAL == 0 && i > 0){
+            for(unordered_map<uint64_t, Diagonal>::iterator it = diagonals.begin(); it != diagonals.end(); ){
+                if(it->second.scannedTo < i)
+                    it = diagonals.erase(it);
+                else
+                    it++;
+            }
+            if(seedCache.size() > SLIDING_MAX_CACHED_SEEDS)
+                seedCache.clear();
+        }
+        
+        // the k-mer starting at i ends at i+k-1; roll everything up to there in
+        for(long long j = (i == 0 ? 0 : i + k - 1); j < i + k; j++){
+            int code = DNA5::encode(bases[j]);
+            if(code < 0 || code > 3){
+                valid = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | code) & mask;
+            valid++;
+        }
+        
+        vector<Posting> lookedUp;
+        const vector<Posting>* seeds = &lookedUp;
+        if(rolling && valid >= k){
+            unordered_map<uint64_t, vector<Posting>>::iterator it = seedCache.find(kmer);
+            if(it == seedCache.end())
+                it = seedCache.insert(make_pair(kmer, index.lookup(bases.substr(i, k), exactMatchOnly, filtered ? &candidates : nullptr))).first;
+            seeds = &it->second;
+        }else{
+            lookedUp = index.lookup(bases.substr(i, k), exactMatchOnly, filtered ? &candidates : nullptr);
+        }
+        
+        for(size_t s = 0; s < seeds->size(); s++){
+            int genome = (*seeds)[s].genome();
+            long long pos = (*seeds)[s].position();
+            if(lastWindow[genome] == i || (filtered && !candidates[genome]))
+                continue;
+            if(pos + fragmentMatchLength > m_genomes[genome].length())
+                continue;
+            
+            // diagonals are keyed like Postings; d only wraps if the query is
+            // longer than 2^40 bases
+            long long d = pos - i;
+            uint64_t key = ((uint64_t)genome << POSTING_POSITION_BITS) | ((uint64_t)d & (MAX_GENOME_LENGTH - 1));
+            // most seed hits are chance hits that fail after a base or two, so a
+            // diagonal is only remembered once one of its windows has matched
+            unordered_map<uint64_t, Diagonal>::iterator known = diagonals.find(key);
+            Diagonal fresh;
+            Diagonal& diag = (known != diagonals.end()) ? known->second : fresh;
+            if(diag.scannedTo < i){         // new diagonal, or one we've moved past
+                diag.scannedTo = i;
+                diag.numMismatches = 0;
+            }
+            while(diag.numMismatches > 0 && diag.mismatches[0] < i){
+                diag.mismatches[0] = diag.mismatches[1];
+                diag.numMismatches--;
+            }
+            
+            // compare whatever part of this window hasn't been compared yet,
+            // stopping early once there are too many mismatches
+            long long end = i + fragmentMatchLength;
+            if(diag.scannedTo < end && diag.numMismatches <= errorsAllowed){
+                long long start = diag.scannedTo;
+                string genomeFrag;
+                m_genomes[genome].extract(start + d, end - start, genomeFrag);
+                for(long long j = start; j < end && diag.numMismatches <= errorsAllowed; j++){
+                    if(bases[j] != genomeFrag[j - start])
+                        diag.mismatches[diag.numMismatches++] = j;
+                    diag.scannedTo = j + 1;
+                }
+            }
+            
+            // a window matches if it has no more than errorsAllowed mismatches in
+            // it, and (as with the trie) its first base isn't one of them
+            bool firstMismatched = diag.numMismatches > 0 && diag.mismatches[0] == i;
+            if(diag.scannedTo >= end && diag.numMismatches <= errorsAllowed && !firstMismatched){
+                lastWindow[genome] = i;
+                numMatches[genome]++;
+                if(known == diagonals.end())
+                    diagonals[key] = fresh;
+            }
+        }
+    }
+    
+    for(size_t id = 0; id < numMatches.size(); id++){
+        if(numMatches[id] == 0)
+            continue;
+        double percent = (double)numMatches[id]/numWindows * 100;
+        if(percent >= matchPercentThreshold){
+            GenomeMatchById g;
+            g.genomeId = id;
+            g.percentMatch = percent;
+            results.push_back(g);
+        }
+    }
+    sortRelated(results);
+    
+    if(results.size() > 0)
+        return true;
+    return false;
+}
+
+// orders by percent, descending, then by genome name
+void GenomeMatcherImpl::sortRelated(vector<GenomeMatchById>& results) const
+{
+    sort(results.begin(), results.end(), [this](const GenomeMatchById& g1, const GenomeMatchById& g2){
+        if(g1.percentMatch == g2.percentMatch){
+            return m_names[g1.genomeId] < m_names[g2.genomeId];
+        }
+        return g1.percentMatch > g2.percentMatch;
+    });
+}
+
+void GenomeMatcherImpl::nameRelated(const vector<GenomeMatchById>& byId, vector<GenomeMatch>& results) const
+{
+    results.clear();
+    for(size_t i = 0; i < byId.size(); i++){
+        GenomeMatch g;
+        g.genomeName = m_names[byId[i].genomeId];
+        g.percentMatch = byId[i].percentMatch;
+        g.percentError = byId[i].percentError;
+        results.push_back(g);
+    }
+}
+
+void GenomeMatcherImpl::clearCache()
+{
+    lock_guard<mutex> lock(m_cacheMutex);
+    m_cache.clear();
+    m_cacheIndex.clear();
+    m_cacheBytes = 0;
+}
+
+void GenomeMatcherImpl::setFragmentCacheSize(size_t capacityBytes)
+{
+    clearCache();
+    lock_guard<mutex> lock(m_cacheMutex);
+    m_cacheCapacity = capacityBytes;
+}
+
+FragmentCacheStats GenomeMatcherImpl::fragmentCacheStats() const
+{
+    lock_guard<mutex> lock(m_cacheMutex);
+    FragmentCacheStats stats;
+    stats.hits = m_cacheHits;
+    stats.misses = m_cacheMisses;
+    stats.entries = m_cache.size();
+    stats.bytes = m_cacheBytes;
+    stats.capacityBytes = m_cacheCapacity;
+    return stats;
+}
+
+void GenomeMatcherImpl::setMemoryBudget(size_t budgetBytes)
+{
+    m_memoryBudget = budgetBytes;
+}
+
+MemoryStats GenomeMatcherImpl::memoryStats() const
+{
+    MemoryStats stats;
+    stats.sequenceBytes = m_sequenceBytes;
+    stats.indexBytes = m_indexMemory.bytes();
+    stats.frozenIndexBytes = m_frozenIndexMemory.bytes();
+    stats.sketchBytes = m_sketchMemory.bytes();
+    {
+        lock_guard<mutex> lock(m_cacheMutex);
+        stats.cacheBytes = m_cacheBytes;
+    }
+    stats.budgetBytes = m_memoryBudget;
+    return stats;
+}
+
 //******************** GenomeMatcher functions ********************************
 
 // These functions simply delegate to GenomeMatcherImpl's functions.
@@ -220,9 +1431,9 @@ GenomeMatcher::~GenomeMatcher()
     delete m_impl;
 }
 
-void GenomeMatcher::addGenome(const Genome& genome)
+bool GenomeMatcher::addGenome(const Genome& genome)
 {
-    m_impl->addGenome(genome);
+    return m_impl->addGenome(genome);
 }
 
 int GenomeMatcher::minimumSearchLength() const
@@ -239,3 +1450,99 @@ bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLen
 {
     return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
 }
+
+bool GenomeMatcher::findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomesApprox(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, maxPercentError, results);
+}
+
+void GenomeMatcher::setRelatedGenomesPrefilter(bool enabled, double slackPercent)
+{
+    m_impl->setRelatedGenomesPrefilter(enabled, slackPercent);
+}
+
+
+bool GenomeMatcher::freezeIndex()
+{
+    return m_impl->freezeIndex();
+}
+
+bool GenomeMatcher::setMinimumSearchLength(int minSearchLength)
+{
+    return m_impl->setMinimumSearchLength(minSearchLength);
+}
+
+bool GenomeMatcher::addSearchIndex(int searchLength)
+{
+    return m_impl->addSearchIndex(searchLength);
+}
+
+void GenomeMatcher::removeSearchIndex(int searchLength)
+{
+    m_impl->removeSearchIndex(searchLength);
+}
+
+vector<int> GenomeMatcher::searchIndexLengths() const
+{
+    return m_impl->searchIndexLengths();
+}
+
+void GenomeMatcher::setFragmentCacheSize(size_t capacityBytes)
+{
+    m_impl->setFragmentCacheSize(capacityBytes);
+}
+
+FragmentCacheStats GenomeMatcher::fragmentCacheStats() const
+{
+    return m_impl->fragmentCacheStats();
+}
+
+void GenomeMatcher::setMemoryBudget(size_t budgetBytes)
+{
+    m_impl->setMemoryBudget(budgetBytes);
+}
+
+MemoryStats GenomeMatcher::memoryStats() const
+{
+    return m_impl->memoryStats();
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const
+{
+    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNAUncached(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatchById>& matches) const
+{
+    return m_impl->findGenomesWithThisDNAUncached(fragment, minimumLength, exactMatchOnly, matches);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const
+{
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, vector<GenomeMatchById>& results) const
+{
+    return m_impl->findRelatedGenomesApprox(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, maxPercentError, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomesSliding(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatchById>& results) const
+{
+    return m_impl->findRelatedGenomesSliding(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
+int GenomeMatcher::numGenomes() const
+{
+    return m_impl->numGenomes();
+}
+
+const string& GenomeMatcher::genomeName(int genomeId) const
+{
+    return m_impl->genomeName(genomeId);
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "GzipStream.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <cstring>
+#include <zlib.h>
+using namespace std;
+
+const size_t GZIP_CHUNK = 256 * 1024;
+const int BGZF_BLOCKS_PER_THREAD = 16;
+
+bool isGzipStream(istream& source)
+{
+    if(!source)
+        return false;
+
+    // peek() only gives us one byte, so read the second one and put it back
+    if(source.peek() != 0x1f)
+        return false;
+    source.get();
+    bool gzip = source.peek() == 0x8b;
+    source.unget();
+    return gzip;
+}
+
+static unsigned int littleEndian(const unsigned char* p, int numBytes)
+{
+    unsigned int v = 0;
+    for(int i = numBytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+  // inflates one complete BGZF block into out, which must be exactly the
+  // size recorded in the block's ISIZE trailer
+static bool inflateBgzfBlock(const string& block, char* out, size_t outLen)
+{
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(block.data());
+    size_t headerLen = 12 + littleEndian(b + 10, 2);
+    if(block.size() < headerLen + 8)
+        return false;
+
+    // an empty block (like the EOF marker) has nothing to inflate into, and
+    // zlib rejects a null output buffer, so just check its trailer
+    unsigned int crc = littleEndian(b + block.size() - 8, 4);
+    if(outLen == 0)
+        return crc == 0;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -15) != Z_OK)       // raw deflate data, no zlib/gzip wrapper
+        return false;
+    zs.next_in = const_cast<Bytef*>(b + headerLen);
+    zs.avail_in = static_cast<uInt>(block.size() - headerLen - 8);
+    zs.next_out = reinterpret_cast<Bytef*>(out);
+    zs.avail_out = static_cast<uInt>(outLen);
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if(ret != Z_STREAM_END || zs.avail_out != 0)
+        return false;
+
+    return crc == crc32(0, reinterpret_cast<const Bytef*>(out), static_cast<uInt>(outLen));
+}
+
+GzipStreambuf::GzipStreambuf(istream& source, int numThreads)
+:m_source(source), m_bgzf(false), m_corrupt(false), m_done(false),
+ m_numThreads(numThreads), m_zsInit(false), m_atMemberStart(false), m_in(GZIP_CHUNK)
+{
+    if(m_numThreads <= 0)
+        m_numThreads = max(1u, thread::hardware_concurrency());
+    memset(&m_zs, 0, sizeof(m_zs));
+
+    // read the first member's header to find out whether this is BGZF; a BGZF
+    // block has the FEXTRA flag set and a "BC" subfield holding the block size
+    string header(10, '\0');
+    m_source.read(&header[0], 10);
+    if(m_source.gcount() != 10 || (unsigned char)header[0] != 0x1f || (unsigned char)header[1] != 0x8b){
+        m_corrupt = true;
+        m_done = true;
+        return;
+    }
+    if(header[3] & 0x04){
+        char xlenBytes[2];
+        m_source.read(xlenBytes, 2);
+        size_t xlen = littleEndian(reinterpret_cast<unsigned char*>(xlenBytes), 2);
+        string extra(xlen, '\0');
+        m_source.read(&extra[0], xlen);
+        header.append(xlenBytes, 2);
+        header += extra;
+
+        const unsigned char* x = reinterpret_cast<const unsigned char*>(extra.data());
+        for(size_t i = 0; i + 4 <= xlen; i += 4 + littleEndian(x + i + 2, 2)){
+            if(x[i] == 'B' && x[i+1] == 'C' && littleEndian(x + i + 2, 2) == 2 && i + 6 <= xlen){
+                m_bgzf = true;
+                size_t blockSize = littleEndian(x + i + 4, 2) + 1;
+                if(blockSize < header.size()){
+                    m_corrupt = true;
+                    m_done = true;
+                    return;
+                }
+                string rest(blockSize - header.size(), '\0');
+                m_source.read(&rest[0], rest.size());
+                if(m_source.gcount() != static_cast<streamsize>(rest.size())){
+                    m_corrupt = true;
+                    m_done = true;
+                    return;
+                }
+                m_firstBlock = header + rest;
+                break;
+            }
+        }
+    }
+
+    if(m_bgzf){
+        startNextBgzfBatch();
+        return;
+    }
+
+    // not BGZF: hand the bytes we've already consumed to zlib as its first input
+    if(inflateInit2(&m_zs, 15 + 16) != Z_OK){       // +16 expects a gzip wrapper
+        m_corrupt = true;
+        m_done = true;
+        return;
+    }
+    m_zsInit = true;
+    if(header.size() > m_in.size())
+        m_in.resize(header.size());
+    memcpy(m_in.data(), header.data(), header.size());
+    m_zs.next_in = reinterpret_cast<Bytef*>(m_in.data());
+    m_zs.avail_in = static_cast<uInt>(header.size());
+}
+
+GzipStreambuf::~GzipStreambuf()
+{
+    if(m_pending.valid())
+        m_pending.wait();
+    if(m_zsInit)
+        inflateEnd(&m_zs);
+}
+
+GzipStreambuf::int_type GzipStreambuf::underflow()
+{
+    if(gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    if(m_done)
+        return traits_type::eof();
+
+    bool filled = m_bgzf ? fillBgzf() : fillGzip();
+    if(!filled){
+        m_done = true;
+        return traits_type::eof();
+    }
+    setg(m_out.data(), m_out.data(), m_out.data() + m_out.size());
+    return traits_type::to_int_type(*gptr());
+}
+
+bool GzipStreambuf::fillGzip()
+{
+    m_out.resize(GZIP_CHUNK);
+    m_zs.next_out = reinterpret_cast<Bytef*>(m_out.data());
+    m_zs.avail_out = static_cast<uInt>(m_out.size());
+
+    while(m_zs.avail_out > 0){
+        if(m_zs.avail_in == 0){
+            m_source.read(m_in.data(), m_in.size());
+            streamsize n = m_source.gcount();
+            if(n <= 0){
+                // running out of input is only fine between gzip members
+                if(!m_atMemberStart)
+                    m_corrupt = true;
+                break;
+            }
+            m_zs.next_in = reinterpret_cast<Bytef*>(m_in.data());
+            m_zs.avail_in = static_cast<uInt>(n);
+        }
+
+        m_atMemberStart = false;
+        int ret = inflate(&m_zs, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END){
+            // concatenated gzip files are valid gzip, so keep going with the next member
+            inflateReset(&m_zs);
+            m_atMemberStart = true;
+        }else if(ret != Z_OK && ret != Z_BUF_ERROR){
+            m_corrupt = true;
+            break;
+        }
+    }
+
+    m_out.resize(m_out.size() - m_zs.avail_out);
+    return !m_out.empty() && !m_corrupt;
+}
+
+bool GzipStreambuf::readBgzfBlocks(vector<string>& blocks)
+{
+    size_t maxBlocks = static_cast<size_t>(m_numThreads) * BGZF_BLOCKS_PER_THREAD;
+    if(!m_firstBlock.empty()){
+        blocks.push_back(m_firstBlock);
+        m_firstBlock.clear();
+    }
+
+    while(blocks.size() < maxBlocks){
+        string header(18, '\0');
+        m_source.read(&header[0], 18);
+        if(m_source.gcount() == 0)
+            return true;                // clean end of file
+        const unsigned char* h = reinterpret_cast<const unsigned char*>(header.data());
+        if(m_source.gcount() != 18 || h[0] != 0x1f || h[1] != 0x8b || !(h[3] & 0x04) ||
+           littleEndian(h + 10, 2) != 6 || h[12] != 'B' || h[13] != 'C')
+            return false;
+
+        size_t blockSize = littleEndian(h + 16, 2) + 1;
+        if(blockSize < 18 + 8)
+            return false;
+        string block = header;
+        block.resize(blockSize);
+        m_source.read(&block[18], blockSize - 18);
+        if(m_source.gcount() != static_cast<streamsize>(blockSize - 18))
+            return false;
+        blocks.push_back(std::move(block));
+    }
+    return true;
+}
+
+void GzipStreambuf::startNextBgzfBatch()
+{
+    vector<string> blocks;
+    bool ok = readBgzfBlocks(blocks);
+    if(blocks.empty() && ok)
+        return;                         // nothing left to decompress
+
+    int numThreads = m_numThreads;
+    m_pending = async(launch::async, [blocks = std::move(blocks), ok, numThreads]() {
+        Batch batch;
+        batch.ok = ok;
+
+        // every block records its uncompressed size, so each thread can inflate
+        // straight into its own slice of the output
+        vector<size_t> offsets(blocks.size() + 1, 0);
+        for(size_t i = 0; i < blocks.size(); i++){
+            const unsigned char* tail = reinterpret_cast<const unsigned char*>(blocks[i].data() + blocks[i].size() - 4);
+            offsets[i+1] = offsets[i] + littleEndian(tail, 4);
+        }
+        batch.data.resize(offsets.back());
+
+        vector<char> blockOk(blocks.size(), 0);
+        auto work = [&](size_t first, size_t step) {
+            for(size_t i = first; i < blocks.size(); i += step)
+                blockOk[i] = inflateBgzfBlock(blocks[i], batch.data.data() + offsets[i], offsets[i+1] - offsets[i]);
+        };
+        size_t step = min(static_cast<size_t>(numThreads), blocks.size());
+        vector<thread> workers;
+        for(size_t t = 1; t < step; t++)
+            workers.push_back(thread(work, t, step));
+        work(0, max<size_t>(step, 1));
+        for(auto& w : workers)
+            w.join();
+
+        for(size_t i = 0; i < blocks.size(); i++){
+            if(!blockOk[i])
+                batch.ok = false;
+        }
+        return batch;
+    });
+}
+
+bool GzipStreambuf::fillBgzf()
+{
+    while(m_pending.valid()){
+        Batch batch = m_pending.get();
+        if(!batch.ok){
+            m_corrupt = true;
+            return false;
+        }
+        startNextBgzfBatch();           // overlap the next batch with reading this one
+        if(!batch.data.empty()){
+            m_out.swap(batch.data);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef GZIPSTREAM_INCLUDED
+#define GZIPSTREAM_INCLUDED
+
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <future>
+#include <zlib.h>
+
+  // Returns true if the next bytes in source are a gzip header (1f 8b).
+  // Nothing is consumed from the stream.
+bool isGzipStream(std::istream& source);
+
+  // A read-only streambuf that inflates a gzip (or concatenated gzip) stream
+  // on the fly.  BGZF files, which are a series of independent gzip blocks,
+  // are recognized from their header and decompressed a batch of blocks at a
+  // time across several threads, with the next batch being inflated in the
+  // background while the current one is being read.
+class GzipStreambuf : public std::streambuf
+{
+public:
+    GzipStreambuf(std::istream& source, int numThreads = 0);
+    ~GzipStreambuf();
+    bool corrupt() const { return m_corrupt; }
+
+    GzipStreambuf(const GzipStreambuf&) = delete;
+    GzipStreambuf& operator=(const GzipStreambuf&) = delete;
+protected:
+    int_type underflow() override;
+private:
+    struct Batch
+    {
+        std::vector<char> data;
+        bool ok;
+    };
+
+    std::istream& m_source;
+    bool m_bgzf;
+    bool m_corrupt;
+    bool m_done;
+    int m_numThreads;
+
+    // plain gzip state
+    z_stream m_zs;
+    bool m_zsInit;
+    bool m_atMemberStart;
+    std::vector<char> m_in;
+
+    // BGZF state
+    std::string m_firstBlock;
+    std::future<Batch> m_pending;
+
+    std::vector<char> m_out;
+
+    bool fillGzip();
+    bool fillBgzf();
+    bool readBgzfBlocks(std::vector<std::string>& blocks);
+    void startNextBgzfBatch();
+};
+
+class GzipIstream : public std::istream
+{
+public:
+    GzipIstream(std::istream& source, int numThreads = 0)
+    :std::istream(nullptr), m_buf(source, numThreads)
+    {
+        rdbuf(&m_buf);
+    }
+    bool corrupt() const { return m_buf.corrupt(); }
+private:
+    GzipStreambuf m_buf;
+};
+
+#endif // GZIPSTREAM_INCLUDED
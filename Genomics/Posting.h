@@ -0,0 +1,187 @@
+#ifndef POSTING_INCLUDED
+#define POSTING_INCLUDED
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include "CountingAllocator.h"
+
+// a (genome id, position within genome) pair packed into the same 8 bytes as a
+// pair<int, int>: the top 24 bits hold the genome id and the low 40 bits hold
+// the position, so a genome can be up to 2^40 bases long.  comparing the packed
+// bits orders postings by genome and then by position.
+const int POSTING_POSITION_BITS = 40;
+const long long MAX_GENOME_LENGTH = 1LL << POSTING_POSITION_BITS;
+const long long MAX_GENOMES = 1LL << (64 - POSTING_POSITION_BITS);
+
+class Posting
+{
+public:
+    Posting() : m_bits(0) {}
+    Posting(int genome, long long position)
+    :m_bits(((uint64_t)genome << POSTING_POSITION_BITS) | (uint64_t)position) {}
+    int genome() const { return (int)(m_bits >> POSTING_POSITION_BITS); }
+    long long position() const { return (long long)(m_bits & (MAX_GENOME_LENGTH - 1)); }
+    bool operator<(const Posting& other) const { return m_bits < other.m_bits; }
+    bool operator==(const Posting& other) const { return m_bits == other.m_bits; }
+private:
+    uint64_t m_bits;
+};
+
+// the posting lists of a frozen index, stored back to back in one byte array.
+// a list is a run of groups, one per genome:
+//     varint  genome id minus the previous group's genome id
+//     varint  number of positions
+//     varint  first position
+//     byte    bit width w
+//     the gaps between consecutive positions, w bits each, packed low bit first
+// every gap in a group has the same width, so unpacking is a fixed shift and
+// mask per position with no branches, and groups for genomes the caller isn't
+// interested in are skipped without being unpacked.
+typedef std::vector<unsigned char, CountingAllocator<unsigned char>> ByteArray;
+
+class PostingLists
+{
+public:
+    explicit PostingLists(MemoryCounter* counter = nullptr)
+    :m_offsets(1, 0, CountingAllocator<uint64_t>(counter)), m_data(PADDING, 0, CountingAllocator<unsigned char>(counter)) {}
+    template<typename Postings>
+    uint64_t add(const Postings& postings);                 // postings must be sorted
+    void decode(uint64_t list, std::vector<Posting>& out, const std::vector<char>* genomes = nullptr) const;
+    void append(PostingLists& other);       // other's list i becomes list numLists() + i here, and other is emptied
+    void reserve(size_t numLists, size_t numBytes);
+    void shrink();                          // gives back whatever was reserved or grown into but not used
+    size_t numLists() const { return m_offsets.size() - 1; }
+    size_t dataBytes() const { return m_data.size() - PADDING; }
+    size_t bytes() const { return m_data.capacity() + m_offsets.capacity() * sizeof(uint64_t); }
+private:
+    // unpacking reads 8 bytes at a time, so the array always ends in this much slack
+    static const int PADDING = 8;
+    std::vector<uint64_t, CountingAllocator<uint64_t>> m_offsets;     // list i is m_data[m_offsets[i], m_offsets[i+1])
+    ByteArray m_data;
+};
+
+inline void putVarint(ByteArray& out, uint64_t v){
+    while(v >= 0x80){
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+inline int varintBytes(uint64_t v){
+    int n = 1;
+    for( ; v >= 0x80; v >>= 7)
+        n++;
+    return n;
+}
+
+inline uint64_t getVarint(const unsigned char*& p){
+    uint64_t v = 0;
+    for(int shift = 0; ; shift += 7){
+        unsigned char byte = *p++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return v;
+    }
+}
+
+template<typename Postings>
+uint64_t PostingLists::add(const Postings& postings)
+{
+    m_data.resize(m_data.size() - PADDING);
+    int prevGenome = 0;
+    for(size_t first = 0; first < postings.size(); ){
+        int genome = postings[first].genome();
+        size_t last = first + 1;
+        uint64_t widest = 0;
+        while(last < postings.size() && postings[last].genome() == genome){
+            widest = std::max(widest, (uint64_t)(postings[last].position() - postings[last-1].position()));
+            last++;
+        }
+        int width = 0;
+        while(width < 64 && (widest >> width) != 0)
+            width++;
+        
+        putVarint(m_data, genome - prevGenome);
+        putVarint(m_data, last - first);
+        putVarint(m_data, postings[first].position());
+        m_data.push_back((unsigned char)width);
+        
+        size_t start = m_data.size();
+        m_data.resize(start + ((last - first - 1) * width + 7) / 8, 0);
+        for(size_t i = first + 1; i < last; i++){
+            size_t bit = (i - first - 1) * width;
+            uint64_t gap = (uint64_t)(postings[i].position() - postings[i-1].position()) << (bit % 8);
+            for(size_t byte = start + bit/8; gap != 0; byte++, gap >>= 8){
+                m_data[byte] |= (unsigned char)gap;
+            }
+        }
+        prevGenome = genome;
+        first = last;
+    }
+    m_data.resize(m_data.size() + PADDING, 0);
+    m_offsets.push_back(m_data.size() - PADDING);
+    return (uint64_t)(m_offsets.size() - 2);
+}
+
+inline void PostingLists::append(PostingLists& other)
+{
+    uint64_t base = m_data.size() - PADDING;
+    m_data.resize(base);
+    m_data.insert(m_data.end(), other.m_data.begin(), other.m_data.end() - PADDING);
+    m_data.resize(m_data.size() + PADDING, 0);
+    for(size_t i = 1; i < other.m_offsets.size(); i++){
+        m_offsets.push_back(base + other.m_offsets[i]);
+    }
+    PostingLists empty(other.m_data.get_allocator().counter());
+    std::swap(other, empty);
+}
+
+inline void PostingLists::reserve(size_t numLists, size_t numBytes)
+{
+    m_offsets.reserve(numLists + 1);
+    m_data.reserve(numBytes + PADDING);
+}
+
+inline void PostingLists::shrink()
+{
+    if(m_offsets.capacity() > m_offsets.size())
+        std::vector<uint64_t, CountingAllocator<uint64_t>>(m_offsets.begin(), m_offsets.end(), m_offsets.get_allocator()).swap(m_offsets);
+    if(m_data.capacity() > m_data.size())
+        ByteArray(m_data.begin(), m_data.end(), m_data.get_allocator()).swap(m_data);
+}
+
+// appends list's postings to out, leaving out genomes not marked in genomes (if given)
+inline void PostingLists::decode(uint64_t list, std::vector<Posting>& out, const std::vector<char>* genomes) const
+{
+    const unsigned char* p = m_data.data() + m_offsets[list];
+    const unsigned char* end = m_data.data() + m_offsets[list+1];
+    int genome = 0;
+    while(p < end){
+        genome += (int)getVarint(p);
+        uint64_t count = getVarint(p);
+        long long position = (long long)getVarint(p);
+        int width = *p++;
+        size_t packedBytes = ((count - 1) * width + 7) / 8;
+        if(genomes != nullptr && !(*genomes)[genome]){
+            p += packedBytes;
+            continue;
+        }
+        
+        const uint64_t mask = (width == 64) ? UINT64_MAX : ((uint64_t)1 << width) - 1;
+        out.push_back(Posting(genome, position));
+        for(uint64_t i = 0; i + 1 < count; i++){
+            size_t bit = i * width;
+            uint64_t word;
+            std::memcpy(&word, p + bit/8, sizeof(word));        // little-endian, like every platform we build on
+            position += (word >> (bit % 8)) & mask;
+            out.push_back(Posting(genome, position));
+        }
+        p += packedBytes;
+    }
+}
+
+#endif // POSTING_INCLUDED
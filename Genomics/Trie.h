@@ -4,9 +4,57 @@
 #include <string>
 #include <cstring>
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include "Alphabet.h"
+#include "CountingAllocator.h"
 
+  // a read-only bit vector that can count the set bits before any position in
+  // constant time: a running total per 64-bit word plus one popcount
+class RankBitVector
+{
+public:
+    explicit RankBitVector(MemoryCounter* counter = nullptr)
+    :m_words(CountingAllocator<uint64_t>(counter)), m_ranks(CountingAllocator<uint64_t>(counter)) {}
+    void push_back(bool bit){
+        if(m_size % 64 == 0){
+            m_ranks.push_back(m_words.empty() ? 0 : m_ranks.back() + (uint64_t)__builtin_popcountll(m_words.back()));
+            m_words.push_back(0);
+        }
+        if(bit)
+            m_words.back() |= (uint64_t)1 << (m_size % 64);
+        m_size++;
+    }
+    bool get(size_t i) const{
+        return (m_words[i/64] >> (i%64)) & 1;
+    }
+    size_t rank(size_t i) const{       // number of set bits before position i
+        return m_ranks[i/64] + __builtin_popcountll(m_words[i/64] & (((uint64_t)1 << (i%64)) - 1));
+    }
+    size_t count() const{              // number of set bits
+        return m_size == 0 ? 0 : rank(m_size - 1) + get(m_size - 1);
+    }
+    void clear(){
+        Words(m_words.get_allocator()).swap(m_words);
+        Ranks(m_ranks.get_allocator()).swap(m_ranks);
+        m_size = 0;
+    }
+    size_t bytes() const{
+        return m_words.capacity() * sizeof(uint64_t) + m_ranks.capacity() * sizeof(uint64_t);
+    }
+private:
+    typedef std::vector<uint64_t, CountingAllocator<uint64_t>> Words;
+    typedef std::vector<uint64_t, CountingAllocator<uint64_t>> Ranks;
+    Words m_words;
+    Ranks m_ranks;
+    size_t m_size = 0;
+};
 
-template<typename ValueType>
+  // the general trie: any char can be a label, and a node's children are kept
+  // in a list that gets searched.  fixed alphabets are specializations below.
+template<typename ValueType, typename Alphabet = CharAlphabet>
 class Trie
 {
 public:
@@ -15,6 +63,13 @@ public:
     void reset();
     void insert(const std::string& key, const ValueType& value);
     std::vector<ValueType> find(const std::string& key, bool exactMatchOnly) const;
+    template<typename Function>
+    void forEachKey(Function visit) const;     // calls visit(key, values) for every key with values
+    
+      // packs everything inserted so far into a compact read-only layout.  later
+      // inserts go into a small mutable trie alongside it, and find() returns the
+      // frozen values first.  freezing again merges the two.
+    void freeze();
 
 //    void dump();                    // remember to comment out
     
@@ -28,32 +83,64 @@ private:
         std::vector<ValueType> values;
     };
     
-    Node* m_root;
+    Node* m_root;           // the mutable trie (everything inserted since the last freeze)
+    
+    // the frozen trie, nodes numbered breadth first from the root (node 0), so
+    // the children of node i are the consecutive nodes
+    // [m_childStart[i], m_childStart[i+1]).  a node's values are found through
+    // the rank of its bit in m_hasValues.  offsets and ranks are 64 bits so a
+    // big library can't overflow them.
+    std::vector<char> m_labels;
+    std::vector<uint64_t> m_childStart;
+    RankBitVector m_hasValues;
+    std::vector<uint64_t> m_valueStart;
+    std::vector<ValueType> m_values;
+    
+    static_assert(Alphabet::SIZE == 0, "fixed alphabets need their own specialization");
+    
     void deleteTrie(Node* n);
+    void clearFrozen();
     bool insertHelper(const char key[], const ValueType& value, Node* curr);
-    std::vector<ValueType> findHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, Node* curr) const;
+    void findHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, Node* curr) const;
+    void findFrozenHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, uint64_t node) const;
+    void addFrozenValues(uint64_t node, std::vector<ValueType>& matches) const;
+    template<typename Function>
+    void forEachKeyHelper(std::string& key, Function& visit, Node* curr) const;
+    template<typename Function>
+    void forEachFrozenKeyHelper(std::string& key, Function& visit, uint64_t node) const;
     
 //    void toilet(Node* n);
 };
 
-template<typename ValueType>
-Trie<ValueType>::Trie(){
+template<typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::Trie(){
     m_root = new Node();
 }
 
-template<typename ValueType>
-Trie<ValueType>::~Trie(){
+template<typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::~Trie(){
     deleteTrie(m_root);
 }
 
-template<typename ValueType>
-void Trie<ValueType>::reset(){
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::reset(){
     deleteTrie(m_root);
     m_root = new Node();
+    clearFrozen();
 }
 
-template<typename ValueType>
-void Trie<ValueType>::deleteTrie(Node* n){     // deletes all nodes in Trie
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::clearFrozen(){
+    // swap with empties so the memory is actually given back
+    std::vector<char>().swap(m_labels);
+    std::vector<uint64_t>().swap(m_childStart);
+    m_hasValues.clear();
+    std::vector<uint64_t>().swap(m_valueStart);
+    std::vector<ValueType>().swap(m_values);
+}
+
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::deleteTrie(Node* n){     // deletes all nodes in Trie
     if(n == nullptr)
         return;
     
@@ -63,16 +150,16 @@ void Trie<ValueType>::deleteTrie(Node* n){     // deletes all nodes in Trie
     delete n; 
 }
 
-template<typename ValueType>
-void Trie<ValueType>::insert(const std::string& key, const ValueType& value){
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::insert(const std::string& key, const ValueType& value){
     if(key.length() == 0)   // check that key is valid (is not empty)
         return;
     
     insertHelper(key.c_str(), value, m_root);
 }
 
-template<typename ValueType>
-bool Trie<ValueType>::insertHelper(const char key[], const ValueType& value, Node* curr){
+template<typename ValueType, typename Alphabet>
+bool Trie<ValueType, Alphabet>::insertHelper(const char key[], const ValueType& value, Node* curr){
     if(key[0] == '\0')      // returns true if the key is empty, returns false otherwise
         return true;
 
@@ -95,31 +182,48 @@ bool Trie<ValueType>::insertHelper(const char key[], const ValueType& value, Nod
     return false;
 }
 
-template<typename ValueType>
-std::vector<ValueType> Trie<ValueType>::find(const std::string& key, bool exactMatchOnly) const{
+template<typename ValueType, typename Alphabet>
+std::vector<ValueType> Trie<ValueType, Alphabet>::find(const std::string& key, bool exactMatchOnly) const{
     std::vector<ValueType> matches;
+    if(key.length() == 0)
+        return matches;
+    
+    // the frozen part first; again the first char has to match, regardless of exact matches
+    if(!m_childStart.empty()){
+        for(uint64_t c = m_childStart[0]; c < m_childStart[1]; c++){
+            if(m_labels[c] == key[0]){
+                if(key[1] == '\0')
+                    addFrozenValues(c, matches);
+                else
+                    findFrozenHelper(key.c_str() + 1, exactMatchOnly, matches, c);
+                break;
+            }
+        }
+    }
+    
     Node* curr = m_root;
     
     // check that the first char is a match, regardless of exact matches
     for(int i = 0; i < curr->children.size(); i++){
         if(curr->children[i] != nullptr && curr->children[i]->label == key[0]){
-            return findHelper(key.c_str(), exactMatchOnly, matches, curr->children[i]);
+            findHelper(key.c_str(), exactMatchOnly, matches, curr->children[i]);
+            break;
         }
     }
-    // if there are no matching first chars, return an empty vector
+    // if there are no matching first chars, this returns an empty vector
     return matches;
 }
 
-template<typename ValueType>
-std::vector<ValueType> Trie<ValueType>::findHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, Node* curr) const{
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::findHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, Node* curr) const{
     
     // base case: key is empty, return immediately
     if(key[0] == '\0')
-        return matches;
+        return;
     
     // base case 2: the node is a nullptr, return immediately
     if(curr == nullptr)
-        return matches;
+        return;
     
     // the label of the ecurrent node equals the next key char
     if(curr->label == key[0]){
@@ -146,20 +250,136 @@ std::vector<ValueType> Trie<ValueType>::findHelper(const char key[], bool exactM
             }
         }
     }
-    return matches;
+}
+
+// key holds the chars still to match below node, which has already matched
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::findFrozenHelper(const char key[], bool exactMatchOnly, std::vector<ValueType>& matches, uint64_t node) const{
+    for(uint64_t c = m_childStart[node]; c < m_childStart[node+1]; c++){
+        bool same = m_labels[c] == key[0];
+        if(!same && exactMatchOnly)
+            continue;
+        // a mismatch uses up the one we're allowed, so the rest must match exactly
+        if(key[1] == '\0')
+            addFrozenValues(c, matches);
+        else
+            findFrozenHelper(key+1, exactMatchOnly || !same, matches, c);
+    }
+}
+
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::addFrozenValues(uint64_t node, std::vector<ValueType>& matches) const{
+    if(!m_hasValues.get(node))
+        return;
+    size_t j = m_hasValues.rank(node);
+    matches.insert(matches.end(), m_values.begin() + m_valueStart[j], m_values.begin() + m_valueStart[j+1]);
+}
+
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::freeze(){
+    // fold the old frozen part back into the pointer trie, ahead of the newer values
+    if(!m_childStart.empty()){
+        Node* recent = m_root;
+        m_root = new Node();
+        auto reinsert = [this](const std::string& key, const std::vector<ValueType>& values){
+            for(int i = 0; i < values.size(); i++)
+                insert(key, values[i]);
+        };
+        std::string key;
+        forEachFrozenKeyHelper(key, reinsert, 0);
+        for(int i = 0; i < recent->children.size(); i++){
+            forEachKeyHelper(key, reinsert, recent->children[i]);
+        }
+        deleteTrie(recent);
+        clearFrozen();
+    }
+    
+    // number the nodes breadth first; the queue ends up holding them in that order
+    std::vector<Node*> queue(1, m_root);
+    size_t numValued = 0, numValues = 0;
+    for(size_t i = 0; i < queue.size(); i++){
+        Node* n = queue[i];
+        queue.insert(queue.end(), n->children.begin(), n->children.end());
+        if(n->values.size() > 0){
+            numValued++;
+            numValues += n->values.size();
+        }
+    }
+    
+    m_labels.reserve(queue.size());
+    m_childStart.reserve(queue.size() + 1);
+    m_valueStart.reserve(numValued + 1);
+    m_values.reserve(numValues);
+    uint64_t nextChild = 1;
+    for(size_t i = 0; i < queue.size(); i++){
+        Node* n = queue[i];
+        m_labels.push_back(n->label);
+        m_childStart.push_back(nextChild);
+        nextChild += n->children.size();
+        m_hasValues.push_back(n->values.size() > 0);
+        if(n->values.size() > 0){
+            m_valueStart.push_back((uint64_t)m_values.size());
+            m_values.insert(m_values.end(), n->values.begin(), n->values.end());
+        }
+    }
+    m_childStart.push_back(nextChild);
+    m_valueStart.push_back((uint64_t)m_values.size());
+    
+    deleteTrie(m_root);
+    m_root = new Node();
 }
 
 
 
+// a key that was inserted both before and after the last freeze is visited twice
+template<typename ValueType, typename Alphabet>
+template<typename Function>
+void Trie<ValueType, Alphabet>::forEachKey(Function visit) const{
+    std::string key;
+    if(!m_childStart.empty())
+        forEachFrozenKeyHelper(key, visit, 0);
+    for(int i = 0; i < m_root->children.size(); i++){
+        forEachKeyHelper(key, visit, m_root->children[i]);
+    }
+}
+
+template<typename ValueType, typename Alphabet>
+template<typename Function>
+void Trie<ValueType, Alphabet>::forEachKeyHelper(std::string& key, Function& visit, Node* curr) const{
+    key.push_back(curr->label);
+    if(curr->values.size() > 0)
+        visit(key, curr->values);
+    for(int i = 0; i < curr->children.size(); i++){
+        forEachKeyHelper(key, visit, curr->children[i]);
+    }
+    key.pop_back();
+}
+
+template<typename ValueType, typename Alphabet>
+template<typename Function>
+void Trie<ValueType, Alphabet>::forEachFrozenKeyHelper(std::string& key, Function& visit, uint64_t node) const{
+    for(uint64_t c = m_childStart[node]; c < m_childStart[node+1]; c++){
+        key.push_back(m_labels[c]);
+        if(m_hasValues.get(c)){
+            size_t j = m_hasValues.rank(c);
+            std::vector<ValueType> values(m_values.begin() + m_valueStart[j], m_values.begin() + m_valueStart[j+1]);
+            visit(key, values);
+        }
+        forEachFrozenKeyHelper(key, visit, c);
+        key.pop_back();
+    }
+}
+
+
 //////////////////////////////////
 /*
-template<typename ValueType>
-void Trie<ValueType>::dump(){
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::dump(){
     toilet(m_root);
 }
 
-template<typename ValueType>
-void Trie<ValueType>::toilet(Node* n){
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::toilet(Node* n){
     if(n == nullptr )
         return;
     
@@ -172,4 +392,627 @@ void Trie<ValueType>::toilet(Node* n){
     }
 }
 */
+
+//////////////////////////////////
+// the DNA5 trie: a node's children are indexed by base code, so finding the
+// next node is an array lookup instead of a search through labels.  keys with
+// anything other than A, C, G, T or N in them are never stored.  everything
+// the trie allocates is charged to the MemoryCounter it is given, if any.
+
+template<typename ValueType>
+class Trie<ValueType, DNA5>
+{
+public:
+    template<typename T>
+    using Array = std::vector<T, CountingAllocator<T>>;
+    typedef Array<ValueType> Values;
+    
+    explicit Trie(MemoryCounter* counter = nullptr);
+    ~Trie();
+    void reset();
+    size_t insert(const std::string& key, const ValueType& value);     // returns the number of nodes it added
+    std::vector<ValueType> find(const std::string& key, bool exactMatchOnly) const;
+      // like find(), but only looks in the frozen part, and gives each match's
+      // rank among the frozen keys in breadth-first order rather than its
+      // values.  a key's rank stays the same until the next freeze.
+    std::vector<uint64_t> findFrozenRanks(const std::string& key, bool exactMatchOnly) const;
+    template<typename Function>
+    void forEachKey(Function visit) const;     // calls visit(key, values) for every key with values, as Values
+    void freeze();                              // same as the general trie's freeze()
+    
+      // freezes the keys of this trie's frozen part together with those of
+      // recent's pointer part, leaving recent alone.  for each key,
+      // merge(values, recentValues, out) gets its values from the two (as
+      // Values, either one possibly empty) and appends what the key should
+      // now hold to out.  this trie's own pointer part is left out, so it
+      // should be empty.
+    template<typename OtherValue, typename Merge>
+    void freezeWith(const Trie<OtherValue, DNA5>& recent, Merge merge);
+      // replaces this trie's frozen part with the frozen parts of parts, whose
+      // keys are all longer than prefixLength chars.  every key in a part starts
+      // with the same prefixLength chars, no two parts share those, and parts
+      // are in order of them.  adjust(p, value) gives what a value from
+      // parts[p] becomes.  the parts are emptied.
+    template<typename Adjust>
+    void freezeParts(const std::vector<Trie*>& parts, size_t prefixLength, Adjust adjust);
+    size_t numNodes() const { return m_numNodes + m_childMask.size(); }    // pointer and frozen nodes
+    size_t existingPrefixLength(const std::string& key) const;             // leading chars of key already in the trie
+    static size_t bytesPerNode() { return sizeof(Node); }     // not counting values
+      // what freezing needs while it runs: this much per node of the result,
+      // at most another word per node with values (plus the values), and this much
+      // per node of its widest level, for the breadth-first walk
+    static size_t bytesPerFrozenNode() { return sizeof(uint8_t) + 1; }
+    static size_t bytesPerFrozenValuedNode() { return sizeof(uint64_t); }
+    static size_t bytesPerFrozenLevelNode() { return 2 * (sizeof(Node*) + 1); }
+    
+    Trie(const Trie&) = delete;
+    Trie& operator=(const Trie&) = delete;
+private:
+    template<typename, typename> friend class Trie;
+    static const int FANOUT = DNA5::SIZE;
+    static const int CHILD_SAMPLE = 32;         // frozen nodes per stored child offset
+    static const bool STORES_VALUES = !std::is_empty<ValueType>::value;     // an empty type's values are only counted
+    
+    struct Node{
+        Node(MemoryCounter* counter) : values(CountingAllocator<ValueType>(counter)) {}
+        Node* children[FANOUT] = {};
+        Values values;
+    };
+    
+    MemoryCounter* m_counter;
+    size_t m_numNodes;                          // in the pointer trie, root included
+    Node* m_root;
+    
+    // the frozen trie, nodes numbered breadth first from the root (node 0).
+    // bit c of m_childMask[i] says whether node i has a child for base code c.
+    // numbered that way, node i's children are consecutive from 1 plus the
+    // number of mask bits set before node i, and the one for c comes after
+    // the bits set below c.  like RankBitVector, only every CHILD_SAMPLE'th of
+    // those running totals is stored, in m_childSamples, and the masks since
+    // are counted a word at a time.  the j'th node with values has
+    // m_values[firstValue(j), firstValue(j+1)); while every such node has
+    // exactly one value, m_valueStart is left empty and that is just j.
+    Array<uint8_t> m_childMask;
+    Array<uint64_t> m_childSamples;
+    RankBitVector m_hasValues;
+    Array<uint64_t> m_valueStart;
+    Values m_values;
+    
+    Node* newNode();
+    void deleteTrie(Node* n);
+    void clearFrozen();
+    static bool validKey(const std::string& key);
+    uint64_t childStart(uint64_t node) const;
+    uint64_t frozenChild(uint64_t node, int code) const{
+        return childStart(node) + __builtin_popcount(m_childMask[node] & ((1u << code) - 1));
+    }
+    void findHelper(const char key[], size_t keyLength, bool exactMatchOnly, std::vector<ValueType>& matches, const Node* curr) const;
+    template<typename Visit>
+    void findFrozen(const std::string& key, bool exactMatchOnly, Visit visit) const;
+    template<typename Visit>
+    void findFrozenHelper(const char key[], size_t keyLength, bool exactMatchOnly, Visit& visit, uint64_t node) const;
+    uint64_t firstValue(size_t j) const { return m_valueStart.empty() ? j : m_valueStart[j]; }
+    template<typename Container>
+    void copyFrozenValues(size_t j, Container& out) const;
+    static void addValueStart(Array<uint64_t>& valueStart, uint64_t& numValued, uint64_t& numValues, uint64_t count, size_t expected);
+    template<typename OtherNode, typename Merge>
+    void mergeFrozen(const OtherNode* recent, Merge& merge);
+    template<typename Function>
+    void forEachKeyHelper(std::string& key, Function& visit, const Node* curr) const;
+    template<typename Function>
+    void forEachFrozenKeyHelper(std::string& key, Function& visit, uint64_t node) const;
+};
+
+template<typename ValueType>
+Trie<ValueType, DNA5>::Trie(MemoryCounter* counter)
+:m_counter(counter), m_numNodes(0), m_childMask(counter), m_childSamples(counter), m_hasValues(counter),
+ m_valueStart(counter), m_values(counter){
+    m_root = newNode();
+}
+
+template<typename ValueType>
+Trie<ValueType, DNA5>::~Trie(){
+    deleteTrie(m_root);
+}
+
+template<typename ValueType>
+void Trie<ValueType, DNA5>::reset(){
+    deleteTrie(m_root);
+    m_root = newNode();
+    clearFrozen();
+}
+
+template<typename ValueType>
+void Trie<ValueType, DNA5>::clearFrozen(){
+    Array<uint8_t>(m_counter).swap(m_childMask);
+    Array<uint64_t>(m_counter).swap(m_childSamples);
+    m_hasValues.clear();
+    Array<uint64_t>(m_counter).swap(m_valueStart);
+    Values(m_counter).swap(m_values);
+}
+
+template<typename ValueType>
+typename Trie<ValueType, DNA5>::Node* Trie<ValueType, DNA5>::newNode(){
+    Node* n = CountingAllocator<Node>(m_counter).allocate(1);
+    m_numNodes++;
+    return new (n) Node(m_counter);
+}
+
+template<typename ValueType>
+void Trie<ValueType, DNA5>::deleteTrie(Node* n){
+    if(n == nullptr)
+        return;
+    for(int c = 0; c < FANOUT; c++){
+        deleteTrie(n->children[c]);
+    }
+    n->~Node();
+    CountingAllocator<Node>(m_counter).deallocate(n, 1);
+    m_numNodes--;
+}
+
+// returns false if key has a char outside the alphabet.  keys are encoded a
+// char at a time as they're walked, which is just a table lookup, rather than
+// into a buffer up front.
+template<typename ValueType>
+bool Trie<ValueType, DNA5>::validKey(const std::string& key){
+    bool valid = true;
+    for(size_t i = 0; i < key.length(); i++){
+        valid &= DNA5::encode(key[i]) >= 0;
+    }
+    return valid;
+}
+
+template<typename ValueType>
+size_t Trie<ValueType, DNA5>::insert(const std::string& key, const ValueType& value){
+    if(key.length() == 0 || !validKey(key))
+        return 0;
+    
+    size_t numNodes = m_numNodes;
+    Node* curr = m_root;
+    for(size_t i = 0; i < key.length(); i++){
+        Node*& next = curr->children[DNA5::encode(key[i])];
+        if(next == nullptr)
+            next = newNode();
+        curr = next;
+    }
+    curr->values.push_back(value);
+    return m_numNodes - numNodes;
+}
+
+// the sample before node, plus the bits set in the masks since.  a word
+// of masks has as many bits set as its bytes have between them.
+template<typename ValueType>
+uint64_t Trie<ValueType, DNA5>::childStart(uint64_t node) const{
+    uint64_t first = node - node % CHILD_SAMPLE;
+    uint64_t start = m_childSamples[first / CHILD_SAMPLE];
+    const uint8_t* masks = m_childMask.data();
+    uint64_t i = first;
+    for( ; i + sizeof(uint64_t) <= node; i += sizeof(uint64_t)){
+        uint64_t word;
+        memcpy(&word, masks + i, sizeof(word));
+        start += __builtin_popcountll(word);
+    }
+    uint64_t word = 0;
+    memcpy(&word, masks + i, node - i);
+    return start + __builtin_popcountll(word);
+}
+
+// the longest prefix of key that has a node in either the pointer or the
+// frozen part.  inserting key adds a pointer node for each char past the
+// pointer part's prefix, and freezing adds a node for each char past both.
+template<typename ValueType>
+size_t Trie<ValueType, DNA5>::existingPrefixLength(const std::string& key) const{
+    const Node* curr = m_root;
+    size_t i = 0;
+    for( ; i < key.length(); i++){
+        int code = DNA5::encode(key[i]);
+        if(code < 0 || curr->children[code] == nullptr)
+            break;
+        curr = curr->children[code];
+    }
+    if(m_childMask.empty())
+        return i;
+    
+    uint64_t node = 0;
+    size_t j = 0;
+    for( ; j < key.length(); j++){
+        int code = DNA5::encode(key[j]);
+        if(code < 0 || !(m_childMask[node] >> code & 1))
+            break;
+        node = frozenChild(node, code);
+    }
+    return std::max(i, j);
+}
+
+template<typename ValueType>
+std::vector<ValueType> Trie<ValueType, DNA5>::find(const std::string& key, bool exactMatchOnly) const{
+    std::vector<ValueType> matches;
+    findFrozen(key, exactMatchOnly, [&](uint64_t node){
+        if(m_hasValues.get(node))
+            copyFrozenValues(m_hasValues.rank(node), matches);
+    });
+    
+    // the first base has to match, regardless of exact matches; a char outside
+    // the alphabet anywhere else just never matches, like any other mismatch
+    int first = key.empty() ? -1 : DNA5::encode(key[0]);
+    if(first < 0)
+        return matches;
+    const Node* child = m_root->children[first];
+    if(child != nullptr){
+        if(key.length() == 1)
+            matches.insert(matches.end(), child->values.begin(), child->values.end());
+        else
+            findHelper(&key[1], key.length() - 1, exactMatchOnly, matches, child);
+    }
+    return matches;
+}
+
+// key holds the bases still to match below curr
+template<typename ValueType>
+void Trie<ValueType, DNA5>::findHelper(const char key[], size_t keyLength, bool exactMatchOnly, std::vector<ValueType>& matches, const Node* curr) const{
+    // an exact match is a straight walk down
+    if(exactMatchOnly){
+        for(size_t i = 0; i < keyLength && curr != nullptr; i++){
+            int code = DNA5::encode(key[i]);
+            curr = code < 0 ? nullptr : curr->children[code];
+        }
+        if(curr != nullptr)
+            matches.insert(matches.end(), curr->values.begin(), curr->values.end());
+        return;
+    }
+    
+    // otherwise try every child, spending the one allowed mismatch on the ones that differ
+    for(int c = 0; c < FANOUT; c++){
+        const Node* child = curr->children[c];
+        if(child == nullptr)
+            continue;
+        if(keyLength == 1)
+            matches.insert(matches.end(), child->values.begin(), child->values.end());
+        else
+            findHelper(key + 1, keyLength - 1, c != DNA5::encode(key[0]), matches, child);
+    }
+}
+
+template<typename ValueType>
+std::vector<uint64_t> Trie<ValueType, DNA5>::findFrozenRanks(const std::string& key, bool exactMatchOnly) const{
+    std::vector<uint64_t> ranks;
+    findFrozen(key, exactMatchOnly, [&](uint64_t node){
+        if(m_hasValues.get(node))
+            ranks.push_back(m_hasValues.rank(node));
+    });
+    return ranks;
+}
+
+// calls visit(node) for each frozen node that matches key, like find()
+template<typename ValueType>
+template<typename Visit>
+void Trie<ValueType, DNA5>::findFrozen(const std::string& key, bool exactMatchOnly, Visit visit) const{
+    int first = key.empty() ? -1 : DNA5::encode(key[0]);
+    if(first < 0 || m_childMask.empty() || !(m_childMask[0] >> first & 1))
+        return;
+    uint64_t node = frozenChild(0, first);
+    if(key.length() == 1)
+        visit(node);
+    else
+        findFrozenHelper(&key[1], key.length() - 1, exactMatchOnly, visit, node);
+}
+
+template<typename ValueType>
+template<typename Visit>
+void Trie<ValueType, DNA5>::findFrozenHelper(const char key[], size_t keyLength, bool exactMatchOnly, Visit& visit, uint64_t node) const{
+    if(exactMatchOnly){
+        for(size_t i = 0; i < keyLength; i++){
+            int code = DNA5::encode(key[i]);
+            if(code < 0 || !(m_childMask[node] >> code & 1))
+                return;
+            node = frozenChild(node, code);
+        }
+        visit(node);
+        return;
+    }
+    
+    uint64_t child = childStart(node);
+    for(int c = 0; c < FANOUT; c++){
+        if(!(m_childMask[node] >> c & 1))
+            continue;
+        if(keyLength == 1)
+            visit(child);
+        else
+            findFrozenHelper(key + 1, keyLength - 1, c != DNA5::encode(key[0]), visit, child);
+        child++;
+    }
+}
+
+// appends the values of the j'th frozen node with values to out
+template<typename ValueType>
+template<typename Container>
+void Trie<ValueType, DNA5>::copyFrozenValues(size_t j, Container& out) const{
+    uint64_t first = firstValue(j), last = firstValue(j+1);
+    if(STORES_VALUES)
+        out.insert(out.end(), m_values.begin() + first, m_values.begin() + last);
+    else
+        out.resize(out.size() + (last - first));
+}
+
+// records that the next node with values has count of them, numValued such
+// nodes and numValues values after the start.  valueStart stays empty until a
+// node has other than one value; it then gets the starts so far, and room for
+// the expected number of nodes with values.
+template<typename ValueType>
+void Trie<ValueType, DNA5>::addValueStart(Array<uint64_t>& valueStart, uint64_t& numValued, uint64_t& numValues, uint64_t count, size_t expected){
+    if(count != 1 && valueStart.empty()){
+        valueStart.reserve(expected + 1);
+        for(uint64_t j = 0; j < numValued; j++){
+            valueStart.push_back(j);
+        }
+    }
+    if(!valueStart.empty())
+        valueStart.push_back(numValues);
+    numValued++;
+    numValues += count;
+}
+
+template<typename ValueType>
+void Trie<ValueType, DNA5>::freeze(){
+    auto append = [](const Values& frozen, const Values& recent, Values& out){
+        out.insert(out.end(), frozen.begin(), frozen.end());
+        out.insert(out.end(), recent.begin(), recent.end());
+    };
+    mergeFrozen(m_root, append);
+    deleteTrie(m_root);
+    m_root = newNode();
+}
+
+template<typename ValueType>
+template<typename OtherValue, typename Merge>
+void Trie<ValueType, DNA5>::freezeWith(const Trie<OtherValue, DNA5>& recent, Merge merge){
+    mergeFrozen(recent.m_root, merge);
+}
+
+// builds the new frozen arrays straight from the old ones and the pointer trie
+// under recent, without first folding them into one pointer trie.  both are
+// walked breadth first a level at a time, which numbers the merged nodes in
+// the same order as a freeze of the merged pointer trie would.  the old frozen
+// nodes turn up in their own breadth-first order, so a running count tells
+// which one goes with each merged node that has one.  a first walk only
+// counts, so the arrays can be allocated at their final sizes.
+template<typename ValueType>
+template<typename OtherNode, typename Merge>
+void Trie<ValueType, DNA5>::mergeFrozen(const OtherNode* recent, Merge& merge){
+    const decltype(recent->values) noRecentValues;
+    Array<uint8_t> childMask(m_counter);
+    Array<uint64_t> childSamples(m_counter);
+    RankBitVector hasValues(m_counter);
+    Array<uint64_t> valueStart(m_counter);
+    Values values(m_counter);
+    Values frozenValues(m_counter);
+    
+    // each node of a level: its pointer node (or nullptr) and whether it has a frozen one
+    Array<const OtherNode*> level(m_counter), nextLevel(m_counter);
+    Array<bool> inFrozen(m_counter), nextInFrozen(m_counter);
+    size_t numNodes = 0, numValued = 0, widest = 1;
+    uint64_t valuedSoFar = 0, valuesSoFar = 0;
+    for(int pass = 0; pass < 2; pass++){
+        bool counting = (pass == 0);
+        if(!counting){
+            childMask.reserve(numNodes);
+            childSamples.reserve(numNodes / CHILD_SAMPLE + 1);
+            if(STORES_VALUES)
+                values.reserve(numValued);
+            level.reserve(widest);
+            nextLevel.reserve(widest);
+        }
+        level.assign(1, recent);
+        inFrozen.assign(1, !m_childMask.empty());
+        uint64_t frozen = 0;                        // the next old frozen node
+        uint64_t nextChild = 1;
+        while(!level.empty()){
+            if(counting)
+                widest = std::max(widest, level.size());
+            nextLevel.clear();
+            nextInFrozen.clear();
+            for(size_t i = 0; i < level.size(); i++){
+                const OtherNode* n = level[i];
+                uint8_t frozenMask = inFrozen[i] ? m_childMask[frozen] : 0;
+                uint8_t mask = frozenMask;
+                for(int c = 0; n != nullptr && c < FANOUT; c++){
+                    if(n->children[c] != nullptr)
+                        mask |= 1 << c;
+                }
+                bool frozenHasValues = inFrozen[i] && m_hasValues.get(frozen);
+                bool recentHasValues = n != nullptr && n->values.size() > 0;
+                
+                if(counting){
+                    numNodes++;
+                    numValued += frozenHasValues || recentHasValues;
+                }else{
+                    if(childMask.size() % CHILD_SAMPLE == 0)
+                        childSamples.push_back(nextChild);
+                    childMask.push_back(mask);
+                    nextChild += __builtin_popcount(mask);
+                    
+                    frozenValues.clear();
+                    if(frozenHasValues)
+                        copyFrozenValues(m_hasValues.rank(frozen), frozenValues);
+                    size_t numValues = values.size();
+                    if(frozenHasValues || recentHasValues)
+                        merge(frozenValues, n != nullptr ? n->values : noRecentValues, values);
+                    uint64_t added = values.size() - numValues;
+                    hasValues.push_back(added > 0);
+                    if(added > 0)
+                        addValueStart(valueStart, valuedSoFar, valuesSoFar, added, numValued);
+                    if(!STORES_VALUES)
+                        values.clear();
+                }
+                
+                for(int c = 0; c < FANOUT; c++){
+                    if(mask >> c & 1){
+                        nextLevel.push_back(n != nullptr ? n->children[c] : nullptr);
+                        nextInFrozen.push_back(frozenMask >> c & 1);
+                    }
+                }
+                if(inFrozen[i])
+                    frozen++;
+            }
+            level.swap(nextLevel);
+            inFrozen.swap(nextInFrozen);
+        }
+    }
+    if(!valueStart.empty())
+        valueStart.push_back(valuesSoFar);
+    values.shrink_to_fit();
+    
+    m_childMask.swap(childMask);
+    m_childSamples.swap(childSamples);
+    std::swap(m_hasValues, hasValues);
+    m_valueStart.swap(valueStart);
+    m_values.swap(values);
+}
+
+// the parts are copied in breadth first, a level at a time.  above
+// prefixLength, nodes are the distinct prefixes of the parts' keys; each part
+// has a single node at each of those levels, at the same index as its level.
+// below, a level is every part's nodes at that depth, parts in order, which is
+// where a breadth-first freeze of all their keys would put them.
+template<typename ValueType>
+template<typename Adjust>
+void Trie<ValueType, DNA5>::freezeParts(const std::vector<Trie*>& parts, size_t prefixLength, Adjust adjust){
+    std::vector<size_t> used;                   // the parts that have any keys
+    size_t numNodes = 1, numValued = 0, numValues = 0;
+    for(size_t p = 0; p < parts.size(); p++){
+        const Trie* part = parts[p];
+        if(part->m_childMask.empty() || part->m_childMask[0] == 0)
+            continue;
+        used.push_back(p);
+        numNodes += part->m_childMask.size() - 1;
+        numValued += part->m_hasValues.count();
+        numValues += part->m_values.size();
+    }
+    
+    Array<uint8_t> childMask(m_counter);
+    Array<uint64_t> childSamples(m_counter);
+    RankBitVector hasValues(m_counter);
+    Array<uint64_t> valueStart(m_counter);
+    Values values(m_counter);
+    childMask.reserve(numNodes);
+    childSamples.reserve(numNodes / CHILD_SAMPLE + 1);
+    values.reserve(numValues);
+    
+    uint64_t nextChild = 1, valuedSoFar = 0, valuesSoFar = 0;
+    auto addNode = [&](uint8_t mask){
+        if(childMask.size() % CHILD_SAMPLE == 0)
+            childSamples.push_back(nextChild);
+        childMask.push_back(mask);
+        nextChild += __builtin_popcount(mask);
+    };
+    
+    // the shared levels: a part's node at depth d+1 is the child of its node
+    // at depth d for the single code in that node's mask
+    for(size_t d = 0; d < prefixLength; d++){
+        for(size_t i = 0; i < used.size(); ){
+            uint8_t mask = 0;
+            size_t j = i;
+            for( ; j < used.size(); j++){
+                bool samePrefix = true;
+                for(size_t e = 0; e < d && samePrefix; e++){
+                    samePrefix = parts[used[j]]->m_childMask[e] == parts[used[i]]->m_childMask[e];
+                }
+                if(!samePrefix)
+                    break;
+                mask |= parts[used[j]]->m_childMask[d];
+            }
+            addNode(mask);
+            hasValues.push_back(false);
+            i = j;
+        }
+    }
+    
+    // the parts' own levels, from each part's node at depth prefixLength down
+    std::vector<uint64_t> levelStart(used.size(), prefixLength), levelSize(used.size(), 1);
+    if(used.empty()){
+        addNode(0);
+        hasValues.push_back(false);
+    }
+    for(bool more = !used.empty(); more; ){
+        more = false;
+        for(size_t p = 0; p < used.size(); p++){
+            const Trie* part = parts[used[p]];
+            uint64_t nextSize = 0;
+            for(uint64_t i = levelStart[p]; i < levelStart[p] + levelSize[p]; i++){
+                addNode(part->m_childMask[i]);
+                nextSize += __builtin_popcount(part->m_childMask[i]);
+                bool valued = part->m_hasValues.get(i);
+                hasValues.push_back(valued);
+                if(valued){
+                    size_t j = part->m_hasValues.rank(i);
+                    uint64_t first = part->firstValue(j), last = part->firstValue(j+1);
+                    addValueStart(valueStart, valuedSoFar, valuesSoFar, last - first, numValued);
+                    for(uint64_t v = first; STORES_VALUES && v < last; v++){
+                        values.push_back(adjust(used[p], part->m_values[v]));
+                    }
+                }
+            }
+            levelStart[p] += levelSize[p];
+            levelSize[p] = nextSize;
+            more = more || nextSize > 0;
+        }
+    }
+    if(!valueStart.empty())
+        valueStart.push_back(valuesSoFar);
+    
+    for(size_t p = 0; p < parts.size(); p++){
+        parts[p]->clearFrozen();
+    }
+    m_childMask.swap(childMask);
+    m_childSamples.swap(childSamples);
+    std::swap(m_hasValues, hasValues);
+    m_valueStart.swap(valueStart);
+    m_values.swap(values);
+}
+
+// a key that was inserted both before and after the last freeze is visited twice
+template<typename ValueType>
+template<typename Function>
+void Trie<ValueType, DNA5>::forEachKey(Function visit) const{
+    std::string key;
+    if(!m_childMask.empty())
+        forEachFrozenKeyHelper(key, visit, 0);
+    forEachKeyHelper(key, visit, m_root);
+}
+
+// visits the keys below curr, which key spells out
+template<typename ValueType>
+template<typename Function>
+void Trie<ValueType, DNA5>::forEachKeyHelper(std::string& key, Function& visit, const Node* curr) const{
+    for(int c = 0; c < FANOUT; c++){
+        const Node* child = curr->children[c];
+        if(child == nullptr)
+            continue;
+        key.push_back(DNA5::decode(c));
+        if(child->values.size() > 0)
+            visit(key, child->values);
+        forEachKeyHelper(key, visit, child);
+        key.pop_back();
+    }
+}
+
+template<typename ValueType>
+template<typename Function>
+void Trie<ValueType, DNA5>::forEachFrozenKeyHelper(std::string& key, Function& visit, uint64_t node) const{
+    uint64_t child = childStart(node);
+    for(int c = 0; c < FANOUT; c++){
+        if(!(m_childMask[node] >> c & 1))
+            continue;
+        key.push_back(DNA5::decode(c));
+        if(m_hasValues.get(child)){
+            Values values(m_counter);
+            copyFrozenValues(m_hasValues.rank(child), values);
+            visit(key, values);
+        }
+        forEachFrozenKeyHelper(key, visit, child);
+        key.pop_back();
+        child++;
+    }
+}
+
 #endif // TRIE_INCLUDED
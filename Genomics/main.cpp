@@ -4,14 +4,30 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <sstream>
 #include <cctype>
 #include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "Trie.h"
+#include "Alphabet.h"
+#include "GzipStream.h"
 using namespace std;
 
 const string PROVIDED_DIR = "/Users/christopherkha/Desktop/CS32/Gee-nomics/data";
 
+const size_t FRAGMENT_CACHE_BYTES = 64 * 1024 * 1024;
+const size_t MEMORY_BUDGET_BYTES = 0;           // 0 for no budget
+
 const string providedFiles[] = {
     "Ferroplasma_acidarmanus.txt",
     "Halobacterium_jilantaiense.txt",
@@ -34,8 +50,52 @@ void createNewLibrary(GenomeMatcher*& library)
         cout << "Invalid prefix size." << endl;
         return;
     }
+    if (library->numGenomes() > 0)
+    {
+        cout << "Re-index the " << library->numGenomes() << " genomes already loaded (y or n): ";
+        getline(cin, line);
+        if (!line.empty() && tolower(line[0]) == 'y')
+        {
+            auto start = chrono::steady_clock::now();
+            if (!library->setMinimumSearchLength(len))
+            {
+                cout << "Not enough memory in the budget to re-index." << endl;
+                return;
+            }
+            cout << "Re-indexed in " << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+                 << " seconds." << endl;
+            return;
+        }
+    }
     delete library;
     library = new GenomeMatcher(len);
+    library->setFragmentCacheSize(FRAGMENT_CACHE_BYTES);
+    library->setMemoryBudget(MEMORY_BUDGET_BYTES);
+}
+
+void addSearchIndex(GenomeMatcher* library)
+{
+    cout << "Current search indexes:";
+    for (int k : library->searchIndexLengths())
+        cout << " " << k;
+    cout << endl;
+    cout << "Enter search length to index (at least " << library->minimumSearchLength() << "): ";
+    string line;
+    getline(cin, line);
+    int len = atoi(line.c_str());
+    if (len < library->minimumSearchLength())
+    {
+        cout << "Invalid search length." << endl;
+        return;
+    }
+    auto start = chrono::steady_clock::now();
+    if (!library->addSearchIndex(len))
+    {
+        cout << "Not enough memory in the budget for another index." << endl;
+        return;
+    }
+    cout << "Indexed in " << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+         << " seconds; searches for " << len << " or more bases will use it." << endl;
 }
 
 void addOneGenomeManually(GenomeMatcher* library)
@@ -63,12 +123,13 @@ void addOneGenomeManually(GenomeMatcher* library)
     }
     for (char ch : sequence)
         ch = toupper(ch);
-    library->addGenome(Genome(name, sequence));
+    if (!library->addGenome(Genome(name, sequence)))
+        cout << "Not enough memory in the budget to add " << name << "." << endl;
 }
 
 bool loadFile(string filename, vector<Genome>& genomes)
 {
-    ifstream inputf(filename);
+    ifstream inputf(filename, ios::binary);
     if (!inputf)
     {
         cout << "Cannot open file: " << filename << endl;
@@ -95,23 +156,276 @@ void loadOneDataFile(GenomeMatcher* library)
     vector<Genome> genomes;
     if (!loadFile(filename, genomes))
         return;
+    size_t added = 0;
     for (const auto& g : genomes)
-        library->addGenome(g);
-    cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
+    {
+        if (library->addGenome(g))
+            added++;
+        else
+            cout << "Couldn't add " << g.name() << " within the memory budget." << endl;
+    }
+    if (!library->freezeIndex())
+        cout << "Not enough room in the memory budget to compact the index." << endl;
+    cout << "Successfully loaded " << added << " genomes." << endl;
 }
 
-void loadProvidedFiles(GenomeMatcher* library)
+  // A fixed-capacity queue shared between pipeline stages.  push() blocks
+  // while the queue is full, which is what keeps a fast stage from running
+  // arbitrarily far ahead of a slow one.  Once close() has been called and
+  // the queue has drained, pop() returns false.
+template<typename T>
+class BoundedQueue
 {
-    for (const string& f : providedFiles)
+public:
+    BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+    void push(T item)
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_items.size() < m_capacity; });
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+    }
+    bool pop(T& item)
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+        if (m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+    void close()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+    }
+private:
+    size_t m_capacity;
+    bool m_closed;
+    deque<T> m_items;
+    mutex m_mutex;
+    condition_variable m_notFull;
+    condition_variable m_notEmpty;
+};
+
+  // Lets an in-order consumer hold back the stages in front of it.  A
+  // producer calls waitForRoom(i) before it starts on item i, and the
+  // consumer calls advance(n) once items 0 to n-1 are done, so no more than
+  // capacity items are ever in flight or waiting to be put back in order.
+class ReorderWindow
+{
+public:
+    ReorderWindow(size_t capacity) : m_capacity(capacity), m_done(0) {}
+    void waitForRoom(size_t index)
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_hasRoom.wait(lock, [&] { return index < m_done + m_capacity; });
+    }
+    void advance(size_t numDone)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_done = numDone;
+        m_hasRoom.notify_all();
+    }
+private:
+    size_t m_capacity;
+    size_t m_done;
+    mutex m_mutex;
+    condition_variable m_hasRoom;
+};
+
+struct FileContents
+{
+    size_t index;
+    string filename;
+    string bytes;
+    bool opened;
+};
+
+struct ParsedFile
+{
+    size_t index;
+    string filename;
+    vector<Genome> genomes;
+    size_t numBytes;
+    string error;
+};
+
+  // An istream's buffer that reads straight out of an existing string, so a
+  // file that is already in memory can be parsed without copying it again.
+class StringViewStreambuf : public streambuf
+{
+public:
+    StringViewStreambuf(const string& s)
+    {
+        char* p = const_cast<char*>(s.data());
+        setg(p, p, p + s.size());
+    }
+};
+
+  // Load many files at once.  Reader threads pull whole files off disk,
+  // parser threads turn the raw bytes into Genomes, and the calling thread
+  // indexes each file's genomes as soon as they are ready, so I/O, parsing
+  // and indexing overlap.  The queues between the stages are bounded, so a
+  // slow indexer throttles the readers instead of letting parsed genomes
+  // pile up in memory.  Files can finish parsing in any order, but they are
+  // indexed in the order given, so genome IDs are the same from run to run;
+  // a reader doesn't start on a file more than a window's worth ahead of
+  // the next one to index, so one slow file can't leave the rest piling up.
+void loadFilesInParallel(GenomeMatcher* library, const vector<string>& paths)
+{
+    if (paths.empty())
+        return;
+
+    unsigned int cores = thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 2;
+    size_t numReaders = min<size_t>(paths.size(), max(1u, cores / 2));
+    size_t numParsers = min<size_t>(paths.size(), max(1u, cores - 1));
+
+    BoundedQueue<FileContents> rawFiles(numParsers * 2);
+    BoundedQueue<ParsedFile> parsedFiles(numParsers * 2);
+    ReorderWindow window(numParsers * 2);
+    atomic<size_t> nextFile(0);
+    atomic<size_t> readersLeft(numReaders);
+    atomic<size_t> parsersLeft(numParsers);
+
+    vector<thread> workers;
+    for (size_t r = 0; r < numReaders; r++)
+    {
+        workers.push_back(thread([&] {
+            for (size_t i = nextFile++; i < paths.size(); i = nextFile++)
+            {
+                window.waitForRoom(i);
+                FileContents fc;
+                fc.index = i;
+                fc.filename = paths[i];
+                ifstream inputf(paths[i], ios::binary | ios::ate);
+                streamoff size = inputf ? static_cast<streamoff>(inputf.tellg()) : -1;
+                fc.opened = size >= 0;
+                if (fc.opened)
+                {
+                    fc.bytes.resize(static_cast<size_t>(size));
+                    inputf.seekg(0);
+                    inputf.read(&fc.bytes[0], fc.bytes.size());
+                    fc.opened = inputf.gcount() == size;
+                }
+                if (!fc.opened)
+                    fc.bytes = string();
+                rawFiles.push(std::move(fc));
+            }
+            if (--readersLeft == 0)
+                rawFiles.close();
+        }));
+    }
+    for (size_t p = 0; p < numParsers; p++)
     {
-        vector<Genome> genomes;
-        if (loadFile(PROVIDED_DIR + "/" + f, genomes))
+        workers.push_back(thread([&] {
+            FileContents fc;
+            while (rawFiles.pop(fc))
+            {
+                ParsedFile pf;
+                pf.index = fc.index;
+                pf.filename = fc.filename;
+                pf.numBytes = fc.bytes.size();
+                if (!fc.opened)
+                    pf.error = "Cannot open file: ";
+                else
+                {
+                    StringViewStreambuf buffer(fc.bytes);
+                    istream inputs(&buffer);
+                    if (!Genome::load(inputs, pf.genomes))
+                        pf.error = "Improperly formatted file: ";
+                }
+                fc.bytes = string();
+                parsedFiles.push(std::move(pf));
+            }
+            if (--parsersLeft == 0)
+                parsedFiles.close();
+        }));
+    }
+
+    // files finish parsing out of order, so hold on to any that arrive early
+    map<size_t, ParsedFile> early;
+    size_t nextFileToIndex = 0;
+    size_t genomesLoaded = 0;
+    size_t bytesLoaded = 0;
+    ParsedFile parsed;
+    while (parsedFiles.pop(parsed))
+    {
+        early[parsed.index] = std::move(parsed);
+        for (auto it = early.find(nextFileToIndex); it != early.end(); it = early.find(++nextFileToIndex))
         {
-            for (const auto& g : genomes)
-                library->addGenome(g);
-            cout << "Loaded " << genomes.size() << " genomes from " << f << endl;
+            ParsedFile& pf = it->second;
+            if (!pf.error.empty())
+                cout << pf.error << pf.filename << endl;
+            else
+            {
+                size_t added = 0;
+                for (const auto& g : pf.genomes)
+                {
+                    if (library->addGenome(g))
+                        added++;
+                    else
+                        cout << "Couldn't add " << g.name() << " within the memory budget." << endl;
+                }
+                genomesLoaded += added;
+                bytesLoaded += pf.numBytes;
+                cout << "[" << nextFileToIndex + 1 << "/" << paths.size() << "] Loaded " << added
+                     << " genomes from " << pf.filename << endl;
+            }
+            early.erase(it);
         }
+        window.advance(nextFileToIndex);
     }
+    for (auto& t : workers)
+        t.join();
+    if (!library->freezeIndex())
+        cout << "Not enough room in the memory budget to compact the index." << endl;
+    cout << "Loaded " << genomesLoaded << " genomes (" << bytesLoaded / (1024 * 1024)
+         << " MB) from " << paths.size() << " files." << endl;
+}
+
+void loadProvidedFiles(GenomeMatcher* library)
+{
+    vector<string> paths;
+    for (const string& f : providedFiles)
+        paths.push_back(PROVIDED_DIR + "/" + f);
+    loadFilesInParallel(library, paths);
+}
+
+void loadDirectory(GenomeMatcher* library)
+{
+    string dirname;
+    cout << "Enter directory name: ";
+    getline(cin, dirname);
+    if (dirname.empty())
+    {
+        cout << "No directory name entered." << endl;
+        return;
+    }
+    DIR* dir = opendir(dirname.c_str());
+    if (dir == nullptr)
+    {
+        cout << "Cannot open directory: " << dirname << endl;
+        return;
+    }
+    vector<string> paths;
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.')    // skip ., .. and hidden files
+            continue;
+        string path = dirname + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            paths.push_back(path);
+    }
+    closedir(dir);
+    sort(paths.begin(), paths.end());
+    loadFilesInParallel(library, paths);
 }
 
 void findGenome(GenomeMatcher* library, bool exactMatch)
@@ -247,6 +561,321 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
     }
 }
 
+const size_t READ_BATCH_SIZE = 4096;
+const double MAPPING_REPORT_SECONDS = 1.0;
+
+struct Read
+{
+    string name;
+    string bases;
+    string quality;             // empty unless quality strings are being kept
+};
+
+  // Reads one four-line FASTQ record.  Returns false at the end of the input,
+  // or with error set if the record is malformed.  Bases are uppercased, and
+  // anything that isn't A, C, G, T or N becomes N.
+bool readFastqRecord(istream& input, Read& read, bool keepQuality, string& error)
+{
+    string header, plus, quality;
+    while (getline(input, header) && header.empty())
+        ;
+    if (header.empty())
+        return false;
+    if (header[0] != '@' || !getline(input, read.bases) || !getline(input, plus) ||
+        plus.empty() || plus[0] != '+' || !getline(input, quality))
+    {
+        error = "Improperly formatted FASTQ record: " + header;
+        return false;
+    }
+    if (!read.bases.empty() && read.bases.back() == '\r')
+        read.bases.pop_back();
+    if (!quality.empty() && quality.back() == '\r')
+        quality.pop_back();
+    if (quality.size() != read.bases.size())
+    {
+        error = "Quality string length doesn't match the sequence in " + header;
+        return false;
+    }
+
+    // the name is everything up to the first space, as in SAM
+    read.name = header.substr(1, header.find_first_of(" \t\r") - 1);
+    for (char& ch : read.bases)
+    {
+        int code = DNA5::encode(ch);
+        ch = DNA5::decode(code < 0 ? DNA5::encode('N') : code);
+    }
+    if (keepQuality)
+        read.quality = quality;
+    else
+        read.quality.clear();
+    return true;
+}
+
+struct ReadBatch
+{
+    size_t index;
+    vector<Read> reads;
+    string output;                  // one or more TSV lines per read
+    vector<unsigned int> latencies; // microseconds per read
+    size_t numMapped;
+};
+
+string reverseComplement(const string& bases)
+{
+    string rc(bases.rbegin(), bases.rend());
+    for (char& ch : rc)
+        ch = DNA5::complement(ch);
+    return rc;
+}
+
+  // Maps one read, trying both strands, and appends a SAM-style line for each
+  // of its best hits (the longest matches, however many genomes share that
+  // length), or a single unmapped line if there are none.  Returns whether
+  // the read mapped.  Reads almost never repeat, so this skips the fragment
+  // cache rather than contend for its lock and fill it with one-off entries.
+bool mapRead(const GenomeMatcher* library, const Read& read, int minMatchLength, bool exactMatchOnly, string& output)
+{
+    string strands[2] = { read.bases, reverseComplement(read.bases) };
+    vector<DNAMatchById> hits[2];
+    int bestLength = 0;
+    for (int s = 0; s < 2; s++)
+    {
+        if (!library->findGenomesWithThisDNAUncached(strands[s], minMatchLength, exactMatchOnly, hits[s]))
+            hits[s].clear();
+        for (const auto& h : hits[s])
+            bestLength = max(bestLength, h.length);
+    }
+
+    string quality = read.quality.empty() ? "*" : read.quality;
+    if (bestLength == 0)
+    {
+        output += read.name + "\t4\t*\t0\t0\t*\t*\t0\t0\t" + read.bases + "\t" + quality + "\n";
+        return false;
+    }
+
+    size_t numBest = 0;
+    for (int s = 0; s < 2; s++)
+        for (const auto& h : hits[s])
+            if (h.length == bestLength)
+                numBest++;
+
+    // a read matched by the start of its sequence; the rest is soft-clipped
+    string cigar = to_string(bestLength) + "M";
+    if ((size_t)bestLength < read.bases.size())
+        cigar += to_string(read.bases.size() - bestLength) + "S";
+    string mapq = numBest > 1 ? "0" : "255";
+    bool primary = true;
+    for (int s = 0; s < 2; s++)
+    {
+        string strandQuality = quality;
+        if (s == 1 && !read.quality.empty())
+            strandQuality.assign(read.quality.rbegin(), read.quality.rend());
+        for (const auto& h : hits[s])
+        {
+            if (h.length != bestLength)
+                continue;
+            int flag = (s == 1 ? 16 : 0) | (primary ? 0 : 256);
+            output += read.name + "\t" + to_string(flag) + "\t" + library->genomeName(h.genomeId) + "\t" +
+                      to_string(h.position + 1) + "\t" + mapq + "\t" + cigar + "\t*\t0\t0\t" +
+                      strands[s] + "\t" + strandQuality + "\n";
+            primary = false;
+        }
+    }
+    return true;
+}
+
+  // Returns the p-th percentile (0-100) of values, reordering them.
+unsigned int percentile(vector<unsigned int>::iterator first, vector<unsigned int>::iterator last, double p)
+{
+    if (first == last)
+        return 0;
+    auto nth = first + static_cast<size_t>((last - first - 1) * p / 100);
+    nth_element(first, nth, last);
+    return *nth;
+}
+
+  // Map every read in a FASTQ file (optionally gzipped) against the library.
+  // One thread parses reads into batches, worker threads map whole batches,
+  // and the calling thread writes the results in input order as a SAM-like
+  // TSV, printing throughput and per-read latency as it goes.
+void mapReadsFromFile(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter FASTQ file name: ";
+    getline(cin, filename);
+    ifstream inputf(filename, ios::binary);
+    if (!inputf)
+    {
+        cout << "Cannot open file: " << filename << endl;
+        return;
+    }
+    cout << "Enter minimum match length: ";
+    string line;
+    getline(cin, line);
+    int minMatchLength = atoi(line.c_str());
+    if (minMatchLength < library->minimumSearchLength())
+    {
+        cout << "Minimum match length must be at least " << library->minimumSearchLength() << "." << endl;
+        return;
+    }
+    cout << "Require (e)xact match or allow (S)NiPs (e or s): ";
+    getline(cin, line);
+    bool exactMatchOnly = !line.empty() && tolower(line[0]) == 'e';
+    cout << "Keep quality strings in the output (y or N): ";
+    getline(cin, line);
+    bool keepQuality = !line.empty() && tolower(line[0]) == 'y';
+    string outname;
+    cout << "Enter output file name: ";
+    getline(cin, outname);
+    ofstream outputf(outname);
+    if (!outputf)
+    {
+        cout << "Cannot create file: " << outname << endl;
+        return;
+    }
+
+    unsigned int cores = thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 2;
+    size_t numMappers = max(1u, cores > 2 ? cores - 2 : 1);
+    BoundedQueue<ReadBatch> toMap(numMappers * 2);
+    BoundedQueue<ReadBatch> mapped(numMappers * 2);
+    ReorderWindow window(numMappers * 2);
+    atomic<size_t> mappersLeft(numMappers);
+    string parseError;
+
+    vector<thread> workers;
+    workers.push_back(thread([&] {
+        GzipIstream* gzip = isGzipStream(inputf) ? new GzipIstream(inputf) : nullptr;
+        istream& input = gzip != nullptr ? static_cast<istream&>(*gzip) : inputf;
+        ReadBatch batch;
+        batch.index = 0;
+        Read read;
+        while (readFastqRecord(input, read, keepQuality, parseError))
+        {
+            batch.reads.push_back(std::move(read));
+            if (batch.reads.size() == READ_BATCH_SIZE)
+            {
+                size_t next = batch.index + 1;
+                window.waitForRoom(batch.index);
+                toMap.push(std::move(batch));
+                batch = ReadBatch();
+                batch.index = next;
+            }
+        }
+        if (gzip != nullptr && gzip->corrupt() && parseError.empty())
+            parseError = "Corrupt gzip data in " + filename;
+        if (!batch.reads.empty())
+        {
+            window.waitForRoom(batch.index);
+            toMap.push(std::move(batch));
+        }
+        toMap.close();
+        delete gzip;
+    }));
+    for (size_t m = 0; m < numMappers; m++)
+    {
+        workers.push_back(thread([&] {
+            ReadBatch batch;
+            while (toMap.pop(batch))
+            {
+                batch.numMapped = 0;
+                for (const Read& r : batch.reads)
+                {
+                    auto start = chrono::steady_clock::now();
+                    if (mapRead(library, r, minMatchLength, exactMatchOnly, batch.output))
+                        batch.numMapped++;
+                    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+                    batch.latencies.push_back(static_cast<unsigned int>(us.count()));
+                }
+                batch.reads.clear();
+                mapped.push(std::move(batch));
+            }
+            if (--mappersLeft == 0)
+                mapped.close();
+        }));
+    }
+
+    // batches finish out of order, so hold on to any that arrive early; the
+    // window keeps the reader from getting too far ahead of the output
+    outputf << "#QNAME\tFLAG\tRNAME\tPOS\tMAPQ\tCIGAR\tRNEXT\tPNEXT\tTLEN\tSEQ\tQUAL\n";
+    map<size_t, ReadBatch> early;
+    size_t nextBatch = 0;
+    size_t numReads = 0;
+    size_t numMapped = 0;
+    vector<unsigned int> latencies;
+    size_t reportedUpTo = 0;
+    auto started = chrono::steady_clock::now();
+    auto lastReport = started;
+    size_t readsAtLastReport = 0;
+    auto report = [&](bool final) {
+        // progress lines cover the reads since the previous one; the final
+        // line covers the whole run
+        auto now = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double>(now - (final ? started : lastReport)).count();
+        size_t readsSince = final ? numReads : numReads - readsAtLastReport;
+        size_t from = final ? 0 : reportedUpTo;
+        cout << "  " << numReads << " reads, " << numMapped << " mapped, "
+             << static_cast<size_t>(readsSince / max(elapsed, 1e-9)) << " reads/s, latency p50 "
+             << percentile(latencies.begin() + from, latencies.end(), 50) << " us, p99 "
+             << percentile(latencies.begin() + from, latencies.end(), 99) << " us" << endl;
+        reportedUpTo = latencies.size();
+        readsAtLastReport = numReads;
+        lastReport = now;
+    };
+    ReadBatch batch;
+    while (mapped.pop(batch))
+    {
+        early[batch.index] = std::move(batch);
+        for (auto it = early.find(nextBatch); it != early.end(); it = early.find(++nextBatch))
+        {
+            ReadBatch& b = it->second;
+            outputf << b.output;
+            numReads += b.latencies.size();
+            numMapped += b.numMapped;
+            latencies.insert(latencies.end(), b.latencies.begin(), b.latencies.end());
+            early.erase(it);
+        }
+        window.advance(nextBatch);
+        if (chrono::duration<double>(chrono::steady_clock::now() - lastReport).count() >= MAPPING_REPORT_SECONDS)
+            report(false);
+    }
+    for (auto& t : workers)
+        t.join();
+
+    if (!parseError.empty())
+        cout << parseError << endl;
+    cout << "Finished:";
+    report(true);
+}
+
+void showStatistics(GenomeMatcher* library)
+{
+    FragmentCacheStats cache = library->fragmentCacheStats();
+    size_t lookups = cache.hits + cache.misses;
+    cout << "Fragment cache: " << cache.entries << " entries, " << cache.bytes / 1024 << " of "
+         << cache.capacityBytes / 1024 << " KB used" << endl;
+    cout << "  " << cache.hits << " hits, " << cache.misses << " misses";
+    if (lookups > 0)
+    {
+        cout.setf(ios::fixed);
+        cout.precision(2);
+        cout << " (" << 100.0 * cache.hits / lookups << "% hit rate)";
+    }
+    cout << endl;
+
+    MemoryStats memory = library->memoryStats();
+    cout << "Memory: " << memory.totalBytes() / 1024 << " KB";
+    if (memory.budgetBytes > 0)
+        cout << " of a " << memory.budgetBytes / 1024 << " KB budget";
+    cout << endl;
+    cout << "  sequences     " << setw(10) << memory.sequenceBytes / 1024 << " KB" << endl;
+    cout << "  index         " << setw(10) << memory.indexBytes / 1024 << " KB" << endl;
+    cout << "  frozen index  " << setw(10) << memory.frozenIndexBytes / 1024 << " KB" << endl;
+    cout << "  sketches      " << setw(10) << memory.sketchBytes / 1024 << " KB" << endl;
+    cout << "  cache         " << setw(10) << memory.cacheBytes / 1024 << " KB" << endl;
+}
+
 void showMenu()
 {
     cout << "        Commands:" << endl;
@@ -255,6 +884,8 @@ void showMenu()
     cout << "         l - load one data file             f - find related genomes (file)" << endl;
     cout << "         d - load all provided data files   ? - show this menu" << endl;
     cout << "         e - find matches exactly           q - quit" << endl;
+    cout << "         p - load all files in a directory  t - show library statistics" << endl;
+    cout << "         m - map reads from a FASTQ file    x - add an index for longer searches" << endl;
 }
 
 
@@ -267,6 +898,8 @@ int main()
     showMenu();
     
     GenomeMatcher* library = new GenomeMatcher(defaultMinSearchLength);
+    library->setFragmentCacheSize(FRAGMENT_CACHE_BYTES);
+    library->setMemoryBudget(MEMORY_BUDGET_BYTES);
     
     for (;;)
     {
@@ -299,6 +932,18 @@ int main()
             case 'd':
                 loadProvidedFiles(library);
                 break;
+            case 'p':
+                loadDirectory(library);
+                break;
+            case 't':
+                showStatistics(library);
+                break;
+            case 'm':
+                mapReadsFromFile(library);
+                break;
+            case 'x':
+                addSearchIndex(library);
+                break;
             case 'e':
                 findGenome(library, true);
                 break;
@@ -15,9 +15,9 @@ public:
     Genome(const Genome& other);
     Genome& operator=(const Genome& rhs);
     static bool load(std::istream& genomeSource, std::vector<Genome>& genomes);
-    int length() const;
+    long long length() const;
     std::string name() const;
-    bool extract(int position, int length, std::string& fragment) const;
+    bool extract(long long position, long long length, std::string& fragment) const;
 
 private:
     GenomeImpl* m_impl;
@@ -27,13 +27,54 @@ struct DNAMatch
 {
     std::string genomeName;
     int length;
-    int position;
+    long long position;
+};
+
+  // Lower-level results that identify genomes by their ID, which is the
+  // order in which they were added to the GenomeMatcher (0, 1, 2, ...).
+  // Use GenomeMatcher::genomeName() to turn an ID back into a name.
+struct DNAMatchById
+{
+    int genomeId;
+    int length;
+    long long position;
+};
+
+struct GenomeMatchById
+{
+    int genomeId;
+    double percentMatch;
+    double percentError = 0;
 };
 
 struct GenomeMatch
 {
     std::string genomeName;
     double percentMatch;
+    double percentError = 0;    // 95% confidence half-width; 0 when every fragment was checked
+};
+
+struct FragmentCacheStats
+{
+    size_t hits;
+    size_t misses;
+    size_t entries;
+    size_t bytes;
+    size_t capacityBytes;
+};
+
+struct MemoryStats
+{
+    size_t sequenceBytes;       // genome sequences and names
+    size_t indexBytes;          // k-mer index for genomes added since the last freeze
+    size_t frozenIndexBytes;    // frozen k-mer index and its compressed posting lists
+    size_t sketchBytes;         // MinHash sketches used by the prefilter
+    size_t cacheBytes;          // fragment result cache
+    size_t budgetBytes;         // 0 if there is no budget
+    size_t totalBytes() const
+    {
+        return sequenceBytes + indexBytes + frozenIndexBytes + sketchBytes + cacheBytes;
+    }
 };
 
 class GenomeMatcherImpl;
@@ -43,10 +84,64 @@ class GenomeMatcher
 public:
     GenomeMatcher(int minSearchLength);
     ~GenomeMatcher();
-    void addGenome(const Genome& genome);
+      // Returns false, leaving the library unchanged, if the genome is too
+      // big to index or would take the library over its memory budget.
+    bool addGenome(const Genome& genome);
     int minimumSearchLength() const;
     bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+      // Like findRelatedGenomes, but checks a random sample of the query's
+      // fragments and stops once every genome's percentMatch is known to
+      // within maxPercentError (at 95% confidence).
+    bool findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, std::vector<GenomeMatch>& results) const;
+      // Like findRelatedGenomes, but considers every window of
+      // fragmentMatchLength bases in the query (stride 1) instead of only
+      // non-overlapping fragments, so a SNP near a fragment boundary can't
+      // hide a match.  percentMatch is the percentage of windows matched.
+    bool findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatchById>& matches) const;
+      // Like findGenomesWithThisDNA, but never looks in or adds to the
+      // fragment cache, for callers whose fragments rarely repeat (reads).
+    bool findGenomesWithThisDNAUncached(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatchById>& matches) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatchById>& results) const;
+    bool findRelatedGenomesApprox(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double maxPercentError, std::vector<GenomeMatchById>& results) const;
+    bool findRelatedGenomesSliding(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatchById>& results) const;
+    int numGenomes() const;
+    const std::string& genomeName(int genomeId) const;
+      // When enabled, findRelatedGenomes only runs the fragment search against
+      // genomes whose estimated k-mer containment (from a MinHash sketch) is
+      // within slackPercent of matchPercentThreshold.  The sketch uses 21-mers,
+      // so queries with shorter fragments are never filtered.  Off by default.
+    void setRelatedGenomesPrefilter(bool enabled, double slackPercent = 20);
+      // Compresses the index built so far into a read-only form that uses much
+      // less memory.  Genomes added afterwards are indexed as usual until the
+      // next call, which folds them in.  Freezing briefly needs room for the
+      // old and new forms at once; returns false, leaving the index as it is,
+      // if that would go over the memory budget.
+    bool freezeIndex();
+      // Re-indexes the genomes already in the library for a new minimum
+      // search length, using several threads, without reloading anything.
+      // Returns false, leaving the library as it was, if minSearchLength is
+      // less than 1 or the new index wouldn't fit in the memory budget.
+    bool setMinimumSearchLength(int minSearchLength);
+      // Keeps an extra index of searchLength-base k-mers, which must be at
+      // least minimumSearchLength().  Searches with a minimumLength of at
+      // least searchLength seed from the longest such index, which turns up
+      // fewer false candidates.  Returns false if it can't be built.
+    bool addSearchIndex(int searchLength);
+    void removeSearchIndex(int searchLength);
+    std::vector<int> searchIndexLengths() const;
+      // Caches findGenomesWithThisDNA results, least recently used first out,
+      // up to roughly capacityBytes.  0 (the default) turns the cache off.
+      // The cache is emptied whenever addGenome changes the library.
+    void setFragmentCacheSize(size_t capacityBytes);
+    FragmentCacheStats fragmentCacheStats() const;
+      // Caps the memory the library may use, 0 (the default) meaning no cap.
+      // When a genome would go over it, addGenome freezes the index to make
+      // room (if the freeze itself fits), and turns the genome away if that
+      // isn't enough.
+    void setMemoryBudget(size_t budgetBytes);
+    MemoryStats memoryStats() const;
       // We prevent a GenomeMatcher object from being copied or assigned.
     GenomeMatcher(const GenomeMatcher&) = delete;
     GenomeMatcher& operator=(const GenomeMatcher&) = delete;
@@ -0,0 +1,78 @@
+// Checks that a memory budget is never exceeded while genomes are added, and
+// that the budget isn't so conservative that most of it goes unused.
+//
+// Built and run by tests/Makefile (make -C tests).
+
+#include "provided.h"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// a small, fixed pseudo-random sequence, so every run sees the same genomes
+static unsigned int nextRandom(unsigned int& state)
+{
+    state = state * 1103515245 + 12345;
+    return state >> 16;
+}
+
+// numGenomes genomes of length bases, each a copy of one of a few ancestors
+// with one base in 25 changed, like strains of the same species
+static vector<Genome> makeLibrary(int numGenomes, int length)
+{
+    const char bases[] = "ACGT";
+    unsigned int state = 7;
+    vector<string> ancestors(4);
+    for(size_t a = 0; a < ancestors.size(); a++){
+        for(int i = 0; i < length; i++)
+            ancestors[a] += bases[nextRandom(state) % 4];
+    }
+    vector<Genome> library;
+    for(int g = 0; g < numGenomes; g++){
+        string sequence = ancestors[g % ancestors.size()];
+        for(int m = 0; m < length / 25; m++)
+            sequence[nextRandom(state) % length] = bases[nextRandom(state) % 4];
+        library.push_back(Genome("strain" + to_string(g), sequence));
+    }
+    return library;
+}
+
+// adds the whole library under budget, which must end up at least minFill full
+// at some point, with at least minAdded genomes in
+static void checkBudget(const vector<Genome>& library, int minSearchLength, size_t budget, double minFill, int minAdded)
+{
+    GenomeMatcher matcher(minSearchLength);
+    matcher.setMemoryBudget(budget);
+    int numAdded = 0;
+    size_t mostUsed = 0;
+    for(size_t g = 0; g < library.size(); g++){
+        if(matcher.addGenome(library[g]))
+            numAdded++;
+        size_t used = matcher.memoryStats().totalBytes();
+        assert(used <= budget);
+        mostUsed = max(mostUsed, used);
+    }
+    assert(matcher.freezeIndex());
+    assert(matcher.memoryStats().totalBytes() <= budget);
+    assert(numAdded >= minAdded);
+    assert(mostUsed >= minFill * budget);
+
+    // what went in can still be found
+    string fragment;
+    assert(library[0].extract(1000, 2 * minSearchLength, fragment));
+    vector<DNAMatch> matches;
+    assert(matcher.findGenomesWithThisDNA(fragment, minSearchLength, true, matches));
+    bool found = false;
+    for(size_t i = 0; i < matches.size(); i++)
+        found = found || (matches[i].genomeName == library[0].name() && matches[i].position == 1000);
+    assert(found);
+}
+
+int main()
+{
+    vector<Genome> library = makeLibrary(40, 5000);
+    checkBudget(library, 10, 8000000, 0.6, 35);
+    checkBudget(library, 20, 16000000, 0.6, 35);
+    cout << "BudgetTest passed" << endl;
+}
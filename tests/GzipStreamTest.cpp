@@ -0,0 +1,110 @@
+// Checks that GzipIstream reads back plain, concatenated and BGZF gzip data.
+//
+// Built and run by tests/Makefile (make -C tests).
+
+#include "GzipStream.h"
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <zlib.h>
+using namespace std;
+
+static void putLittleEndian(string& out, unsigned int v, int numBytes)
+{
+    for(int i = 0; i < numBytes; i++)
+        out += (char)((v >> (8*i)) & 0xff);
+}
+
+static string deflateRaw(const string& data)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = (uInt)data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = (uInt)out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+static string gzipMember(const string& data)
+{
+    string out("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10);
+    out += deflateRaw(data);
+    putLittleEndian(out, crc32(0, (const Bytef*)data.data(), (uInt)data.size()), 4);
+    putLittleEndian(out, (unsigned int)data.size(), 4);
+    return out;
+}
+
+static string bgzfBlock(const string& data)
+{
+    string compressed = deflateRaw(data);
+    string out("\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00", 16);
+    putLittleEndian(out, (unsigned int)(18 + compressed.size() + 8 - 1), 2);
+    out += compressed;
+    putLittleEndian(out, crc32(0, (const Bytef*)data.data(), (uInt)data.size()), 4);
+    putLittleEndian(out, (unsigned int)data.size(), 4);
+    return out;
+}
+
+static string sampleText(int numLines, int seed)
+{
+    string text;
+    for(int i = 0; i < numLines; i++)
+        text += "ACGTNACGT" + to_string(seed * 1000 + i) + "\n";
+    return text;
+}
+
+static string readAll(const string& compressed, int numThreads, bool& corrupt)
+{
+    istringstream source(compressed);
+    GzipIstream input(source, numThreads);
+    ostringstream out;
+    out << input.rdbuf();
+    corrupt = input.corrupt();
+    return out.str();
+}
+
+static void checkBgzf(int numBlocks, int numThreads)
+{
+    string expected, file;
+    for(int i = 0; i < numBlocks; i++){
+        string text = sampleText(50, i);
+        expected += text;
+        file += bgzfBlock(text);
+    }
+    file += bgzfBlock("");          // the standard EOF marker block
+    bool corrupt;
+    assert(readAll(file, numThreads, corrupt) == expected);
+    assert(!corrupt);
+}
+
+int main()
+{
+    bool corrupt;
+    string text = sampleText(1000, 1);
+    assert(readAll(gzipMember(text), 1, corrupt) == text && !corrupt);
+
+    string more = sampleText(10, 2);
+    assert(readAll(gzipMember(text) + gzipMember(more), 1, corrupt) == text + more && !corrupt);
+
+    // a batch is 16 blocks per thread, so also cover a last batch that holds
+    // nothing but the EOF block
+    for(int numBlocks : { 1, 15, 16, 17, 32, 33 })
+        checkBgzf(numBlocks, 1);
+    checkBgzf(64, 2);
+    checkBgzf(40, 3);
+
+    string truncated = gzipMember(text);
+    truncated.resize(truncated.size() / 2);
+    readAll(truncated, 1, corrupt);
+    assert(corrupt);
+
+    cout << "GzipStreamTest passed" << endl;
+}
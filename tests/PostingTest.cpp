@@ -0,0 +1,179 @@
+// Checks that postings and posting lists keep 40-bit positions and 24-bit
+// genome ids intact, and that Genome::extract handles positions past INT_MAX.
+//
+// Built and run by tests/Makefile (make -C tests).  Run it with "large", or
+// make -C tests large, to also extract from and search a genome longer than
+// INT_MAX bases, which needs about 5 GB of memory.
+
+#include "provided.h"
+#include "Posting.h"
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static void checkPostings()
+{
+    const int genomes[] = { 0, 1, 4095, (int)MAX_GENOMES - 2, (int)MAX_GENOMES - 1 };
+    const long long positions[] = { 0, 1, INT_MAX, (long long)INT_MAX + 1, 1LL << 32, (1LL << 32) + 7,
+                                    MAX_GENOME_LENGTH / 2, MAX_GENOME_LENGTH - 2, MAX_GENOME_LENGTH - 1 };
+    for(int g : genomes){
+        for(long long p : positions){
+            Posting posting(g, p);
+            assert(posting.genome() == g);
+            assert(posting.position() == p);
+        }
+    }
+
+    // ordered by genome first, then by position
+    assert(Posting(1, MAX_GENOME_LENGTH - 1) < Posting(2, 0));
+    assert(Posting(MAX_GENOMES - 1, 0) < Posting(MAX_GENOMES - 1, 1LL << 32));
+    assert(!(Posting(3, 5) < Posting(3, 5)));
+}
+
+static void checkRoundTrip(PostingLists& lists, const vector<Posting>& postings)
+{
+    uint64_t list = lists.add(postings);
+    vector<Posting> decoded;
+    lists.decode(list, decoded);
+    assert(decoded == postings);
+}
+
+static void checkPostingLists()
+{
+    PostingLists lists;
+
+    // gaps above 2^32, and positions right up to the 40-bit limit
+    vector<Posting> wide;
+    wide.push_back(Posting(0, 3));
+    wide.push_back(Posting(0, (1LL << 32) + 3));
+    wide.push_back(Posting(0, (1LL << 33) + 10));
+    wide.push_back(Posting(0, MAX_GENOME_LENGTH - 1));
+    wide.push_back(Posting(7, 0));
+    wide.push_back(Posting(7, MAX_GENOME_LENGTH - 1));
+    checkRoundTrip(lists, wide);
+
+    // genome ids near 2^24, with a mix of narrow and wide groups
+    vector<Posting> highIds;
+    for(long long p = 0; p < 100; p += 3)
+        highIds.push_back(Posting((int)MAX_GENOMES - 3, p));
+    highIds.push_back(Posting((int)MAX_GENOMES - 2, (1LL << 39) + 1));
+    for(int i = 0; i < 20; i++)
+        highIds.push_back(Posting((int)MAX_GENOMES - 1, (1LL << 35) * i + i));
+    checkRoundTrip(lists, highIds);
+
+    // single postings and an empty list
+    checkRoundTrip(lists, vector<Posting>(1, Posting(0, MAX_GENOME_LENGTH - 1)));
+    checkRoundTrip(lists, vector<Posting>(1, Posting((int)MAX_GENOMES - 1, 0)));
+    checkRoundTrip(lists, vector<Posting>());
+
+    // earlier lists are still intact after later ones were added
+    vector<Posting> decoded;
+    lists.decode(0, decoded);
+    assert(decoded == wide);
+    assert(lists.numLists() == 5);
+
+    // filtering by genome skips the other groups without unpacking them
+    vector<char> wanted(MAX_GENOMES, 0);
+    wanted[MAX_GENOMES - 2] = 1;
+    decoded.clear();
+    lists.decode(1, decoded, &wanted);
+    assert(decoded.size() == 1 && decoded[0] == Posting((int)MAX_GENOMES - 2, (1LL << 39) + 1));
+
+    // appended lists are numbered after the ones already there
+    PostingLists more;
+    checkRoundTrip(more, wide);
+    checkRoundTrip(more, highIds);
+    lists.append(more);
+    assert(more.numLists() == 0 && lists.numLists() == 7);
+    decoded.clear();
+    lists.decode(6, decoded);
+    assert(decoded == highIds);
+    decoded.clear();
+    lists.decode(0, decoded);
+    assert(decoded == wide);
+}
+
+static void checkExtract()
+{
+    Genome genome("small", "ACGTNACGTN");
+    string fragment;
+    assert(genome.extract(5, 5, fragment) && fragment == "ACGTN");
+    assert(genome.extract(10, 0, fragment) && fragment == "");
+    assert(!genome.extract(6, 5, fragment));
+    assert(!genome.extract(-1, 2, fragment));
+    assert(!genome.extract(2, -1, fragment));
+
+    // positions past INT_MAX are out of range, not truncated to an int, and
+    // position + length must not overflow
+    assert(!genome.extract((long long)INT_MAX + 1, 2, fragment));
+    assert(!genome.extract(1LL << 32, 2, fragment));
+    assert(!genome.extract(2, (1LL << 32) + 2, fragment));
+    assert(!genome.extract(LLONG_MAX, 1, fragment));
+    assert(!genome.extract(1, LLONG_MAX, fragment));
+}
+
+static void checkLargeExtract()
+{
+    const long long length = (long long)INT_MAX + 1025;
+    string sequence(length, 'A');
+    memcpy(&sequence[(long long)INT_MAX - 2], "CGTNC", 5);
+    memcpy(&sequence[length - 4], "GATC", 4);
+    Genome genome("large", sequence);
+    string().swap(sequence);
+
+    string fragment;
+    assert(genome.length() == length);
+    assert(genome.extract((long long)INT_MAX - 2, 5, fragment) && fragment == "CGTNC");
+    assert(genome.extract(length - 4, 4, fragment) && fragment == "GATC");
+    assert(!genome.extract(length - 3, 4, fragment));
+}
+
+// a genome longer than INT_MAX goes into a GenomeMatcher, and searches find
+// matches past INT_MAX, before and after the index is frozen.  apart from two
+// stretches of bases, the genome is filler outside the alphabet, which the
+// index never stores, so only the sequence itself takes much memory.
+static void checkLargeMatch()
+{
+    const long long length = (long long)INT_MAX + 1025;
+    const string first = "ACGGTCATTGCAAGTCCGATAGCTTAGGCTAACGTTGCAT";
+    const string second = "TTGACCGTAGGCATCGATCCGTAAGCTTGGACTACGATCA";
+    const long long firstAt = (long long)INT_MAX - 20;          // straddles INT_MAX
+    const long long secondAt = length - 50;
+    string sequence(length, '-');
+    memcpy(&sequence[firstAt], first.data(), first.size());
+    memcpy(&sequence[secondAt], second.data(), second.size());
+    Genome genome("large", sequence);
+    string().swap(sequence);
+    
+    GenomeMatcher matcher(16);
+    assert(matcher.addGenome(genome));
+    string snp = second;
+    snp[30] = (snp[30] == 'A' ? 'C' : 'A');
+    for(int frozen = 0; frozen < 2; frozen++){
+        vector<DNAMatch> matches;
+        assert(matcher.findGenomesWithThisDNA(first, 16, true, matches));
+        assert(matches.size() == 1 && matches[0].genomeName == "large");
+        assert(matches[0].position == firstAt && matches[0].length == (int)first.size());
+        
+        assert(matcher.findGenomesWithThisDNA(snp, 16, false, matches));
+        assert(matches.size() == 1 && matches[0].position == secondAt && matches[0].length == (int)snp.size());
+        assert(!matcher.findGenomesWithThisDNA(snp, 32, true, matches));
+        assert(matcher.freezeIndex());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    checkPostings();
+    checkPostingLists();
+    checkExtract();
+    if(argc > 1 && strcmp(argv[1], "large") == 0){
+        checkLargeExtract();
+        checkLargeMatch();
+    }
+    cout << "PostingTest passed" << endl;
+}